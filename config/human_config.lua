@@ -1,6 +1,5 @@
--- Human shape information
+-- Human shape information: humans are circles of this radius.
 hu_radius = 0.1
-hu_num_segments = 20
 
 -- Human start position
 hu_start_x = 39.
@@ -25,4 +24,13 @@ local HumanMode = {
     Repeat=1
 }
 
-hu_mode = HumanMode.Repeat
\ No newline at end of file
+hu_mode = HumanMode.Repeat
+
+-- Human motion model: walk straight at the goal, or steer around walls,
+-- robots and other humans with social forces (only in the crowd engine)
+local HumanMotion = {
+    Direct=0,
+    SocialForce=1
+}
+
+hu_motion = HumanMotion.Direct
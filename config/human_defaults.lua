@@ -0,0 +1,6 @@
+-- Defaults for the optional keys of human configs. Each human config in
+-- human_config_list is loaded after this file, so it only needs to set the
+-- keys it changes.
+
+-- Human motion model: walk straight at the goal (HumanMotion.Direct).
+hu_motion = 0
@@ -17,11 +17,32 @@ init_config_file = "config/default_init_config.lua"
 -- Time-step for simulation.
 delta_t = 0.025
 
+-- Target ratio of simulator time to wall clock time, e.g. 0.1 to run ten
+-- times slower or 10 to run ten times faster than real time. Zero steps as
+-- fast as possible.
+real_time_factor = 1.0
+
+-- Periods, in seconds of simulator time, of the laser of each robot and of
+-- the odometry, TF, localization and visualization messages. Periods are
+-- rounded to a whole number of time-steps, and run every time-step if
+-- shorter. The period of the laser is the scan time of its messages.
+laser_period = delta_t
+odometry_period = delta_t
+tf_period = delta_t
+localization_period = delta_t
+visualization_period = delta_t
+
 -- Simulator TF publications
 publish_tfs = true;
 publish_foot_to_base = true;
 publish_map_to_odom = true;
 
+-- Publish the simulator time on /clock every step, so that nodes with
+-- use_sim_time set follow the simulator even when it runs faster or slower
+-- than the wall clock. Off by default, since another node may already be
+-- publishing /clock.
+publish_clock = false;
+
 -- Car dimensions.
 car_width = 0.281
 car_length = 0.535
@@ -31,6 +52,24 @@ car_height = 0.15;
 rear_axle_offset = -0.162
 laser_loc = Vector3(0.2, 0, 0.15)
 
+-- Response to robots colliding with the map, objects, or each other:
+-- "none" lets robots pass through, "stop" keeps a robot at its pose from
+-- before the colliding step, and "clamp" moves it as far as it can go
+-- without colliding. Robot footprints use the car dimensions above.
+collision_response = "none";
+-- Side of the cells of the spatial hash over objects and robots.
+collision_cell_size = 1.0;
+-- Simulate the humans of human_config_list together in one crowd, stored as
+-- arrays and stepped in parallel, instead of as one object each.
+human_crowd = false;
+-- Side of the cells of the flow fields that route crowd humans around walls
+-- to their goals, or 0 to head straight at the goals.
+human_flow_field_cell_size = 0;
+-- Distance from walls within which flow fields do not lead.
+human_flow_field_clearance = 0.3;
+-- Save flow fields next to the map file, to load them in later runs.
+human_flow_field_save = false;
+
 -- Kinematic and dynamic constraints for the car.
 min_turn_radius = 0.98
 max_speed = 1.2
@@ -38,11 +77,25 @@ max_accel = 3.0
 
 -- Laser rangefinder parameters.
 laser_noise_stddev = 0.01;
+-- Seed for the laser noise. Each robot draws its noise from its own stream,
+-- seeded with this value and the robot index.
+laser_noise_seed = 0;
 laser_angle_min = DegToRad(-135.0);
 laser_angle_max = DegToRad(135.0);
 laser_angle_increment = DegToRad(0.25);
 laser_min_range = 0.02;
 laser_max_range = 100.0;
+-- Scan simulation backend: "analytic" renders the visible scene and then
+-- looks up each ray in it, "simd" intersects packets of rays with all lines
+-- in range using SIMD instructions, which is faster for dense scans.
+laser_scan_backend = "analytic";
+-- Side of the grid cells for which the potentially visible map lines are
+-- precomputed and cached next to the map file. Set to 0 to disable.
+map_visibility_cell_size = 0;
+-- Save the cleaned up map lines and their index next to the map file, as
+-- <map>.map.bin, to load them in later runs. The map directory must be
+-- writable.
+map_cache_save = false;
 
 -- Turning error simulation.
 angular_error_bias = DegToRad(0);
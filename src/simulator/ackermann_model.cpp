@@ -1,5 +1,4 @@
 #include "simulator/ackermann_model.h"
-#include "shared/util/timer.h"
 #include "shared/math/math_util.h"
 #include <eigen3/Eigen/src/Geometry/Rotation2D.h>
 
@@ -46,14 +45,13 @@ void AckermannModel::DriveCallback(const AckermannCurvatureDriveMsg& msg) {
     return;
   }
   last_cmd_ = msg;
-  t_last_cmd_ = GetMonotonicTime();
+  t_last_cmd_ = sim_time_;
+  ++command_count_;
 }
 
 void AckermannModel::Step(const double &dt) {
-  // TODO(jaholtz) For faster than real time simulation we may need
-  // a wallclock invariant method for this.
   static const double kMaxCommandAge = 0.1;
-  if (GetMonotonicTime() > t_last_cmd_ + kMaxCommandAge) {
+  if (sim_time_ > t_last_cmd_ + kMaxCommandAge) {
     last_cmd_.velocity = 0;
   }
   const float vel = vel_.translation.x();
@@ -0,0 +1,65 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    circle.h
+\brief   Circle obstacle primitive.
+*/
+//========================================================================
+
+#include <math.h>
+
+#include "eigen3/Eigen/Dense"
+
+#ifndef SRC_SIMULATOR_CIRCLE_H_
+#define SRC_SIMULATOR_CIRCLE_H_
+
+namespace vector_map {
+
+// Circular obstacle, such as a human or a pole, which the ray caster
+// intersects analytically instead of as a polygon of lines.
+struct Circle {
+  Circle() : center(0, 0), radius(0) {}
+  Circle(const Eigen::Vector2f& center, float radius) :
+      center(center), radius(radius) {}
+
+  // True if the bounding box of the circle overlaps [box_min, box_max].
+  bool InBox(const Eigen::Vector2f& box_min,
+             const Eigen::Vector2f& box_max) const {
+    return (center.x() + radius >= box_min.x() &&
+            center.y() + radius >= box_min.y() &&
+            center.x() - radius <= box_max.x() &&
+            center.y() - radius <= box_max.y());
+  }
+
+  // Distance along the ray from origin with unit direction dir to its first
+  // intersection with the circle, or a negative value if the ray misses it.
+  // Rays from inside the circle miss it.
+  float Intersect(const Eigen::Vector2f& origin,
+                  const Eigen::Vector2f& dir) const {
+    const Eigen::Vector2f c = center - origin;
+    const float b = c.dot(dir);
+    const float d = b * b - c.squaredNorm() + radius * radius;
+    if (b <= 0 || d < 0) return -1;
+    const float t = b - sqrt(d);
+    return (t > 0) ? t : -1;
+  }
+
+  Eigen::Vector2f center;
+  float radius;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_CIRCLE_H_
@@ -0,0 +1,411 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    collision.cpp
+\brief   Collision detection and response for robots.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/geometry.h"
+#include "shared/math/line2d.h"
+#include "shared/math/math_util.h"
+#include "collision.h"
+
+using Eigen::Rotation2Df;
+using Eigen::Vector2f;
+using geometry::Cross;
+using geometry::Line2f;
+using math_util::AngleDiff;
+using math_util::AngleMod;
+using pose_2d::Pose2Df;
+using std::max;
+using std::min;
+using std::string;
+using std::vector;
+using vector_map::Circle;
+
+namespace {
+// True if p is inside or on the boundary of the footprint.
+bool Contains(const collision::Footprint& f, const Vector2f& p) {
+  for (int k = 0; k < 4; ++k) {
+    const Vector2f& c0 = f.corners[k];
+    const Vector2f& c1 = f.corners[(k + 1) % 4];
+    if (Cross<float>(c1 - c0, p - c0) < 0.0) return false;
+  }
+  return true;
+}
+
+// Squared distance from p to the closest point of the segment [p0, p1].
+float SquaredDistance(const Vector2f& p, const Vector2f& p0,
+                      const Vector2f& p1) {
+  const Vector2f d = p1 - p0;
+  const float length_sq = d.squaredNorm();
+  float t = (length_sq > 0.0) ? (p - p0).dot(d) / length_sq : 0.0f;
+  t = max(0.0f, min(1.0f, t));
+  return (p0 + t * d - p).squaredNorm();
+}
+
+bool BoxesOverlap(const Vector2f& min0, const Vector2f& max0,
+                  const Vector2f& min1, const Vector2f& max1) {
+  return (min0.x() <= max1.x() && min1.x() <= max0.x() &&
+          min0.y() <= max1.y() && min1.y() <= max0.y());
+}
+
+Pose2Df Interpolate(const Pose2Df& p0, const Pose2Df& p1, float t) {
+  return Pose2Df(
+      AngleMod(p0.angle + t * AngleDiff(p1.angle, p0.angle)),
+      p0.translation + t * (p1.translation - p0.translation));
+}
+}  // namespace
+
+namespace collision {
+
+bool ParseCollisionResponse(const string& name, CollisionResponse* response) {
+  if (name == "none") {
+    *response = CollisionResponse::kNone;
+  } else if (name == "stop") {
+    *response = CollisionResponse::kStop;
+  } else if (name == "clamp") {
+    *response = CollisionResponse::kClamp;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+Footprint MakeFootprint(const Pose2Df& pose,
+                        float length,
+                        float width,
+                        float center_offset) {
+  const Rotation2Df rotation(pose.angle);
+  const Vector2f center =
+      pose.translation + rotation * Vector2f(center_offset, 0);
+  const Vector2f half_length = rotation * Vector2f(0.5 * length, 0);
+  const Vector2f half_width = rotation * Vector2f(0, 0.5 * width);
+  Footprint f;
+  f.corners[0] = center - half_length - half_width;
+  f.corners[1] = center + half_length - half_width;
+  f.corners[2] = center + half_length + half_width;
+  f.corners[3] = center - half_length + half_width;
+  f.box_min = f.corners[0];
+  f.box_max = f.corners[0];
+  for (int k = 1; k < 4; ++k) {
+    f.box_min = f.box_min.cwiseMin(f.corners[k]);
+    f.box_max = f.box_max.cwiseMax(f.corners[k]);
+  }
+  return f;
+}
+
+bool Overlaps(const Footprint& f, const Line2f& line) {
+  if (!BoxesOverlap(f.box_min, f.box_max,
+                    line.p0.cwiseMin(line.p1), line.p0.cwiseMax(line.p1))) {
+    return false;
+  }
+  for (int k = 0; k < 4; ++k) {
+    if (line.Intersects(f.corners[k], f.corners[(k + 1) % 4])) return true;
+  }
+  // The line does not cross the boundary, so it is either entirely inside
+  // or entirely outside.
+  return Contains(f, line.p0);
+}
+
+bool Overlaps(const Footprint& a, const Footprint& b) {
+  if (!BoxesOverlap(a.box_min, a.box_max, b.box_min, b.box_max)) {
+    return false;
+  }
+  for (int k = 0; k < 4; ++k) {
+    const Line2f edge(a.corners[k], a.corners[(k + 1) % 4]);
+    for (int j = 0; j < 4; ++j) {
+      if (edge.Intersects(b.corners[j], b.corners[(j + 1) % 4])) return true;
+    }
+  }
+  return Contains(a, b.corners[0]) || Contains(b, a.corners[0]);
+}
+
+bool Overlaps(const Footprint& f, const Circle& circle) {
+  const Vector2f radius(circle.radius, circle.radius);
+  if (!BoxesOverlap(f.box_min, f.box_max,
+                    circle.center - radius, circle.center + radius)) {
+    return false;
+  }
+  if (Contains(f, circle.center)) return true;
+  const float radius_sq = circle.radius * circle.radius;
+  for (int k = 0; k < 4; ++k) {
+    if (SquaredDistance(circle.center, f.corners[k], f.corners[(k + 1) % 4]) <=
+        radius_sq) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void GetFootprintLines(const Footprint& footprint, vector<Line2f>* lines) {
+  lines->resize(4);
+  for (int k = 0; k < 4; ++k) {
+    (*lines)[k] = Line2f(footprint.corners[k], footprint.corners[(k + 1) % 4]);
+  }
+}
+
+SpatialHash::SpatialHash(float cell_size) :
+    cell_size_(cell_size),
+    query_(0) {}
+
+void SpatialHash::Clear() {
+  ids_.clear();
+  cells_.clear();
+  bucket_start_.clear();
+  bucket_items_.clear();
+}
+
+SpatialHash::CellRange SpatialHash::Cells(const Vector2f& box_min,
+                                          const Vector2f& box_max) const {
+  CellRange r;
+  r.x0 = floor(box_min.x() / cell_size_);
+  r.y0 = floor(box_min.y() / cell_size_);
+  r.x1 = floor(box_max.x() / cell_size_);
+  r.y1 = floor(box_max.y() / cell_size_);
+  return r;
+}
+
+size_t SpatialHash::Bucket(int x, int y) const {
+  const uint32_t h = static_cast<uint32_t>(x) * 73856093u ^
+      static_cast<uint32_t>(y) * 19349663u;
+  // The number of buckets is a power of two.
+  return h & (bucket_start_.size() - 2);
+}
+
+void SpatialHash::Add(int id,
+                      const Vector2f& box_min,
+                      const Vector2f& box_max) {
+  ids_.push_back(id);
+  cells_.push_back(Cells(box_min, box_max));
+}
+
+void SpatialHash::Build() {
+  size_t num_entries = 0;
+  for (const CellRange& r : cells_) {
+    num_entries += (r.x1 - r.x0 + 1) * (r.y1 - r.y0 + 1);
+  }
+  // Use about twice as many buckets as entries, to keep hash collisions
+  // between cells rare.
+  size_t num_buckets = 64;
+  while (num_buckets < 2 * num_entries) num_buckets *= 2;
+  bucket_start_.assign(num_buckets + 1, 0);
+  for (const CellRange& r : cells_) {
+    for (int y = r.y0; y <= r.y1; ++y) {
+      for (int x = r.x0; x <= r.x1; ++x) {
+        ++bucket_start_[Bucket(x, y) + 1];
+      }
+    }
+  }
+  for (size_t b = 0; b < num_buckets; ++b) {
+    bucket_start_[b + 1] += bucket_start_[b];
+  }
+  bucket_items_.resize(num_entries);
+  vector<int> fill(bucket_start_.begin(), bucket_start_.end() - 1);
+  for (size_t i = 0; i < cells_.size(); ++i) {
+    const CellRange& r = cells_[i];
+    for (int y = r.y0; y <= r.y1; ++y) {
+      for (int x = r.x0; x <= r.x1; ++x) {
+        bucket_items_[fill[Bucket(x, y)]++] = i;
+      }
+    }
+  }
+  item_query_.assign(ids_.size(), query_);
+}
+
+void SpatialHash::Query(const Vector2f& box_min,
+                        const Vector2f& box_max,
+                        vector<int>* ids) {
+  if (ids_.empty()) return;
+  ++query_;
+  if (query_ == 0) {
+    // The query counter wrapped around.
+    std::fill(item_query_.begin(), item_query_.end(), 0);
+    query_ = 1;
+  }
+  const CellRange r = Cells(box_min, box_max);
+  for (int y = r.y0; y <= r.y1; ++y) {
+    for (int x = r.x0; x <= r.x1; ++x) {
+      const size_t b = Bucket(x, y);
+      for (int j = bucket_start_[b]; j < bucket_start_[b + 1]; ++j) {
+        const int i = bucket_items_[j];
+        if (item_query_[i] == query_) continue;
+        item_query_[i] = query_;
+        // Skip items that only share the bucket through a hash collision.
+        const CellRange& c = cells_[i];
+        if (c.x1 < r.x0 || c.x0 > r.x1 || c.y1 < r.y0 || c.y0 > r.y1) {
+          continue;
+        }
+        ids->push_back(ids_[i]);
+      }
+    }
+  }
+}
+
+CollisionChecker::CollisionChecker(float cell_size,
+                                   float length,
+                                   float width,
+                                   float center_offset) :
+    length_(length),
+    width_(width),
+    center_offset_(center_offset),
+    radius_(Vector2f(fabs(center_offset) + 0.5 * length, 0.5 * width).norm()),
+    hash_(cell_size),
+    map_(nullptr),
+    motions_(nullptr) {}
+
+bool CollisionChecker::Collides(int i,
+                                const Pose2Df& pose,
+                                bool others_at_start) {
+  const Footprint f = MakeFootprint(pose, length_, width_, center_offset_);
+  const vector_map::VectorMap& map = *map_;
+  if (map.IndexCurrent()) {
+    candidates_.clear();
+    map.line_grid.QueryBox(f.box_min, f.box_max, &candidates_);
+    for (const int j : candidates_) {
+      if (Overlaps(f, map.lines[j])) return true;
+    }
+  } else {
+    for (const Line2f& l : map.lines) {
+      if (Overlaps(f, l)) return true;
+    }
+  }
+  // Robots are checked at their current poses below, instead of their
+  // footprints in the object index, which are from the previous step.
+  candidates_.clear();
+  map.object_index.Query(f.box_min, f.box_max, [&](int id) {
+    if (!robot_object_[id]) candidates_.push_back(id);
+  });
+  for (const int id : candidates_) {
+    // Objects whose bounding circles miss the footprint are rejected without
+    // transforming their lines and circles.
+    if (!Overlaps(f, map.object_index.Bounds(id))) continue;
+    const vector_map::ShapeView view = map.object_index.View(id);
+    for (int k = 0; k < view.NumLines(); ++k) {
+      if (Overlaps(f, view.Line(k))) return true;
+    }
+    for (int k = 0; k < view.NumCircles(); ++k) {
+      if (Overlaps(f, view.GetCircle(k))) return true;
+    }
+  }
+  candidates_.clear();
+  hash_.Query(f.box_min, f.box_max, &candidates_);
+  for (const int j : candidates_) {
+    if (j == i) continue;
+    const RobotMotion& m = (*motions_)[j];
+    const Footprint other = MakeFootprint(others_at_start ? m.start : m.end,
+                                          length_, width_, center_offset_);
+    if (Overlaps(f, other)) return true;
+  }
+  return false;
+}
+
+void CollisionChecker::Resolve(const vector_map::VectorMap& map,
+                               CollisionResponse response,
+                               vector<RobotMotion>* motions_ptr) {
+  // Number of bisection steps to find the last collision-free pose along
+  // the motion of a robot.
+  static const int kClampIterations = 8;
+  vector<RobotMotion>& motions = *motions_ptr;
+  for (RobotMotion& m : motions) {
+    m.collided = false;
+  }
+  if (response == CollisionResponse::kNone) return;
+  map_ = &map;
+  motions_ = &motions;
+  robot_object_.assign(map.object_index.NumIds(), false);
+  for (const RobotMotion& m : motions) {
+    if (m.object >= 0 && m.object < map.object_index.NumIds()) {
+      robot_object_[m.object] = true;
+    }
+  }
+
+  hash_.Clear();
+  // Every pose a robot can end up at lies within radius_ of the segment from
+  // its start to its end position, so robots are added with that box.
+  const Vector2f radius(radius_, radius_);
+  for (size_t j = 0; j < motions.size(); ++j) {
+    const Vector2f& p0 = motions[j].start.translation;
+    const Vector2f& p1 = motions[j].end.translation;
+    hash_.Add(j,
+              p0.cwiseMin(p1) - radius,
+              p0.cwiseMax(p1) + radius);
+  }
+  hash_.Build();
+
+  // Whether a robot starts in collision is decided against the start poses
+  // of the other robots, so that a robot is not exempted by another one
+  // moving into the pose it is leaving.
+  free_start_.assign(motions.size(), false);
+  for (size_t i = 0; i < motions.size(); ++i) {
+    const RobotMotion& m = motions[i];
+    if (m.start.translation == m.end.translation &&
+        m.start.angle == m.end.angle) {
+      continue;
+    }
+    free_start_[i] = !Collides(i, m.start, true);
+  }
+
+  // Robots are checked against the ends of the motions of robots after them,
+  // which may still be moved back later in the pass, so passes are repeated
+  // until no end changes. Ends only move back along their motions, so this
+  // settles quickly; a chain of robots, each blocked by the next, takes one
+  // pass per robot, which bounds the number of passes.
+  bool changed = true;
+  for (size_t pass = 0; changed && pass <= motions.size(); ++pass) {
+    changed = false;
+    for (size_t i = 0; i < motions.size(); ++i) {
+      RobotMotion& m = motions[i];
+      if (m.start.translation == m.end.translation &&
+          m.start.angle == m.end.angle) {
+        continue;
+      }
+      if (!free_start_[i] || !Collides(i, m.end, false)) continue;
+      m.collided = true;
+      changed = true;
+      if (response == CollisionResponse::kStop) {
+        m.end = m.start;
+        continue;
+      }
+      // The end pose collides. The start pose is free unless another robot
+      // has moved into it, which then is moved back in a later pass.
+      float t_free = 0;
+      float t_collides = 1;
+      for (int k = 0; k < kClampIterations; ++k) {
+        const float t = 0.5 * (t_free + t_collides);
+        if (Collides(i, Interpolate(m.start, m.end, t), false)) {
+          t_collides = t;
+        } else {
+          t_free = t;
+        }
+      }
+      m.end = Interpolate(m.start, m.end, t_free);
+    }
+  }
+  map_ = nullptr;
+  motions_ = nullptr;
+}
+
+}  // namespace collision
@@ -0,0 +1,181 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    collision.h
+\brief   Collision detection and response for robots.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+#include "math/poses_2d.h"
+
+#include "vector_map.h"
+
+#ifndef SRC_SIMULATOR_COLLISION_H_
+#define SRC_SIMULATOR_COLLISION_H_
+
+namespace collision {
+
+// What happens to a robot whose motion over a step would collide.
+enum class CollisionResponse {
+  // Robots move through obstacles.
+  kNone,
+  // The robot stays at its pose from before the step.
+  kStop,
+  // The robot moves as far along its motion as it can without colliding.
+  kClamp,
+};
+
+// Parse "none", "stop" or "clamp". Returns false for any other name.
+bool ParseCollisionResponse(const std::string& name,
+                            CollisionResponse* response);
+
+// Rectangular footprint of a robot at a pose, with corners in
+// counter-clockwise order, and their bounding box.
+struct Footprint {
+  Eigen::Vector2f corners[4];
+  Eigen::Vector2f box_min;
+  Eigen::Vector2f box_max;
+};
+
+// Footprint of length along the heading and width across it, centered at
+// center_offset along the heading from the pose.
+Footprint MakeFootprint(const pose_2d::Pose2Df& pose,
+                        float length,
+                        float width,
+                        float center_offset);
+
+// Exact overlap tests, including containment of one shape in the other.
+bool Overlaps(const Footprint& footprint, const geometry::Line2f& line);
+bool Overlaps(const Footprint& a, const Footprint& b);
+bool Overlaps(const Footprint& footprint, const vector_map::Circle& circle);
+
+// Get the edges of the footprint.
+void GetFootprintLines(const Footprint& footprint,
+                       std::vector<geometry::Line2f>* lines);
+
+// Spatial hash over the bounding boxes of items. Each item is added to the
+// buckets of the grid cells its box overlaps, and cells are hashed into a
+// fixed number of buckets, so the hash covers unbounded worlds, and is
+// rebuilt in time linear in the number of items.
+class SpatialHash {
+ public:
+  explicit SpatialHash(float cell_size);
+
+  // Remove all items.
+  void Clear();
+
+  // Add an item with the given id and bounding box. Build must be called
+  // after all items are added, before any queries.
+  void Add(int id, const Eigen::Vector2f& box_min,
+           const Eigen::Vector2f& box_max);
+
+  void Build();
+
+  // Append to ids, once each, the ids of all items whose boxes may overlap
+  // the query box. May also return some items that do not.
+  void Query(const Eigen::Vector2f& box_min,
+             const Eigen::Vector2f& box_max,
+             std::vector<int>* ids);
+
+ private:
+  struct CellRange {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+  };
+
+  CellRange Cells(const Eigen::Vector2f& box_min,
+                  const Eigen::Vector2f& box_max) const;
+  size_t Bucket(int x, int y) const;
+
+  const float cell_size_;
+  std::vector<int> ids_;
+  std::vector<CellRange> cells_;
+  // Items in each bucket are bucket_items_[bucket_start_[b],
+  // bucket_start_[b + 1]), as indices into ids_.
+  std::vector<int> bucket_start_;
+  std::vector<int> bucket_items_;
+  // Last query that returned each item, to report it only once.
+  std::vector<uint32_t> item_query_;
+  uint32_t query_;
+};
+
+// Motion of a robot over one step.
+struct RobotMotion {
+  // Id of the robot in the object index of the map, if it is there, so that
+  // its own footprint is not mistaken for an obstacle.
+  int object;
+  pose_2d::Pose2Df start;
+  // Pose at the end of the step, updated by the collision response.
+  pose_2d::Pose2Df end;
+  // Set if the motion was changed by the collision response.
+  bool collided;
+};
+
+// Detects and resolves collisions of robot footprints with the map, the lines
+// of other objects, and each other. Map and object lines are looked up in the
+// spatial indices of the map, and robots, which move during the resolution,
+// in a spatial hash over their motions that is rebuilt every step.
+class CollisionChecker {
+ public:
+  // Robot footprints are rectangles with the given dimensions, centered at
+  // center_offset along the heading from the robot pose.
+  CollisionChecker(float cell_size,
+                   float length,
+                   float width,
+                   float center_offset);
+
+  // Resolve collisions of robots that moved from motion.start to motion.end,
+  // in order of index, against the lines and objects of map, and the other
+  // robots at their resolved poses, repeating until no resolved pose
+  // changes. Robots that already collide at their start pose are not
+  // constrained, so that they can move out of collision.
+  void Resolve(const vector_map::VectorMap& map,
+               CollisionResponse response,
+               std::vector<RobotMotion>* motions);
+
+ private:
+  // True if robot i collides at pose, with the other robots at the start or
+  // at the current end of their motions.
+  bool Collides(int i, const pose_2d::Pose2Df& pose, bool others_at_start);
+
+  const float length_;
+  const float width_;
+  const float center_offset_;
+  // Distance from the robot pose to the farthest corner of its footprint.
+  const float radius_;
+
+  SpatialHash hash_;
+  // Buffers for the current call to Resolve.
+  const vector_map::VectorMap* map_;
+  const std::vector<RobotMotion>* motions_;
+  // Whether each object of the map is a robot.
+  std::vector<bool> robot_object_;
+  // Whether each robot is free at its start pose, and so is constrained.
+  std::vector<bool> free_start_;
+  std::vector<int> candidates_;
+};
+
+}  // namespace collision
+
+#endif  // SRC_SIMULATOR_COLLISION_H_
@@ -0,0 +1,192 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    collision_check.cpp
+\brief   Checks that the collision response leaves no robots overlapping
+         each other or the map, on scenes where robots block each other.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+
+#include "shared/math/line2d.h"
+#include "shared/math/poses_2d.h"
+#include "simulator/collision.h"
+#include "simulator/vector_map.h"
+
+using collision::CollisionChecker;
+using collision::CollisionResponse;
+using collision::Footprint;
+using collision::MakeFootprint;
+using collision::RobotMotion;
+using Eigen::Vector2f;
+using geometry::Line2f;
+using pose_2d::Pose2Df;
+using std::vector;
+using vector_map::VectorMap;
+
+DEFINE_int32(robots, 200, "Number of robots moving at random.");
+DEFINE_int32(steps, 200, "Number of random steps to check.");
+DEFINE_int32(seed, 1, "Seed for the robot poses and motions.");
+
+static const float kLength = 0.5;
+static const float kWidth = 0.4;
+static const float kCellSize = 1.0;
+// Robots that touch are not counted as overlapping, since the overlap tests
+// are not exact for footprints that only share a boundary.
+static const float kTolerance = 1e-3;
+
+RobotMotion Motion(const Pose2Df& start, const Pose2Df& end) {
+  RobotMotion m;
+  m.object = -1;
+  m.start = start;
+  m.end = end;
+  m.collided = false;
+  return m;
+}
+
+// True if footprints[i] overlaps the map or any of the other footprints.
+bool OverlapsAny(const VectorMap& map,
+                 const vector<Footprint>& footprints,
+                 size_t i) {
+  for (const Line2f& l : map.lines) {
+    if (collision::Overlaps(footprints[i], l)) return true;
+  }
+  for (size_t j = 0; j < footprints.size(); ++j) {
+    if (j != i && collision::Overlaps(footprints[i], footprints[j])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Number of robots that overlap the map or another robot at the end of their
+// motions by more than kTolerance, where both were free at the start. Robots
+// that start in collision are not constrained, and may move into others.
+int CountOverlaps(const VectorMap& map, const vector<RobotMotion>& motions) {
+  vector<Footprint> start, end;
+  for (const RobotMotion& m : motions) {
+    start.push_back(MakeFootprint(m.start, kLength, kWidth, 0));
+    end.push_back(MakeFootprint(
+        m.end, kLength - 2 * kTolerance, kWidth - 2 * kTolerance, 0));
+  }
+  vector<bool> free_start(motions.size());
+  for (size_t i = 0; i < motions.size(); ++i) {
+    free_start[i] = !OverlapsAny(map, start, i);
+  }
+  int overlaps = 0;
+  for (size_t i = 0; i < motions.size(); ++i) {
+    if (!free_start[i]) continue;
+    bool overlap = false;
+    for (const Line2f& l : map.lines) {
+      overlap = overlap || collision::Overlaps(end[i], l);
+    }
+    for (size_t j = 0; j < motions.size(); ++j) {
+      overlap = overlap || (j != i && free_start[j] &&
+                            collision::Overlaps(end[i], end[j]));
+    }
+    if (overlap) ++overlaps;
+  }
+  return overlaps;
+}
+
+// Robot 0 moves into the spot robot 1 is leaving, and robot 1 runs into a
+// wall, so robot 0 has to be moved back after robot 1 is.
+bool CheckVacatedSpot(CollisionResponse response, const char* name) {
+  const VectorMap map(vector<Line2f>(
+      {Line2f(Vector2f(0.7, -1), Vector2f(0.7, 1))}));
+  vector<RobotMotion> motions = {
+    Motion(Pose2Df(0, Vector2f(-0.6, 0)), Pose2Df(0, Vector2f(0, 0))),
+    Motion(Pose2Df(0, Vector2f(0, 0)), Pose2Df(0, Vector2f(0.6, 0))),
+  };
+  CollisionChecker checker(kCellSize, kLength, kWidth, 0);
+  checker.Resolve(map, response, &motions);
+  const int overlaps = CountOverlaps(map, motions);
+  if (overlaps > 0 || !motions[0].collided || !motions[1].collided) {
+    fprintf(stderr,
+            "ERROR: Vacated spot with %s response: %d overlapping robots, "
+            "collided %d %d\n",
+            name, overlaps, motions[0].collided, motions[1].collided);
+    return false;
+  }
+  return true;
+}
+
+// Robots crowded into a walled square, placed apart and moving at random,
+// so that every robot is free at the start of every step.
+int CountRandomOverlaps(CollisionResponse response) {
+  static const float kSide = 10;
+  const VectorMap map(vector<Line2f>({
+    Line2f(Vector2f(0, 0), Vector2f(kSide, 0)),
+    Line2f(Vector2f(kSide, 0), Vector2f(kSide, kSide)),
+    Line2f(Vector2f(kSide, kSide), Vector2f(0, kSide)),
+    Line2f(Vector2f(0, kSide), Vector2f(0, 0)),
+  }));
+  std::mt19937 rng(FLAGS_seed);
+  std::uniform_real_distribution<float> coordinate(0.5, kSide - 0.5);
+  std::uniform_real_distribution<float> heading(-M_PI, M_PI);
+  std::uniform_real_distribution<float> step(-0.3, 0.3);
+  CollisionChecker checker(kCellSize, kLength, kWidth, 0);
+  vector<Pose2Df> poses;
+  vector<Footprint> footprints;
+  while (static_cast<int>(poses.size()) < FLAGS_robots) {
+    const Pose2Df pose(heading(rng),
+                       Vector2f(coordinate(rng), coordinate(rng)));
+    footprints.push_back(MakeFootprint(pose, kLength, kWidth, 0));
+    if (OverlapsAny(map, footprints, footprints.size() - 1)) {
+      footprints.pop_back();
+    } else {
+      poses.push_back(pose);
+    }
+  }
+  int overlaps = 0;
+  vector<RobotMotion> motions;
+  for (int k = 0; k < FLAGS_steps; ++k) {
+    motions.clear();
+    for (const Pose2Df& pose : poses) {
+      const Pose2Df end(pose.angle + step(rng),
+                        pose.translation + Vector2f(step(rng), step(rng)));
+      motions.push_back(Motion(pose, end));
+    }
+    checker.Resolve(map, response, &motions);
+    overlaps += CountOverlaps(map, motions);
+    for (size_t i = 0; i < motions.size(); ++i) {
+      poses[i] = motions[i].end;
+    }
+  }
+  return overlaps;
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  bool ok = CheckVacatedSpot(CollisionResponse::kStop, "stop");
+  ok = CheckVacatedSpot(CollisionResponse::kClamp, "clamp") && ok;
+  const int stop_overlaps = CountRandomOverlaps(CollisionResponse::kStop);
+  const int clamp_overlaps = CountRandomOverlaps(CollisionResponse::kClamp);
+  printf("%d steps of %d robots, overlaps: stop %d, clamp %d\n",
+         FLAGS_steps, FLAGS_robots, stop_overlaps, clamp_overlaps);
+  if (stop_overlaps > 0 || clamp_overlaps > 0) {
+    fprintf(stderr, "ERROR: Robots moved into collision\n");
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
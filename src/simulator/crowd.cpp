@@ -0,0 +1,323 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    crowd.cpp
+\brief   Structure-of-arrays simulation of many humans.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "crowd.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using std::min;
+using std::swap;
+using std::vector;
+using vector_map::FlowFieldCache;
+using vector_map::VectorMap;
+
+namespace {
+// Parameters of the social force model, from Helbing and Molnar, "Social
+// force model for pedestrian dynamics", 1995, and its later calibrations.
+// Time over which a human adjusts its velocity to the desired one.
+const float kRelaxationTime = 0.5;
+// Strength in m/s^2 and range in m of the repulsion between humans, which
+// is the gradient of a potential of 2.1 m^2/s^2 at contact.
+const float kHumanStrength = 2.1 / 0.3;
+const float kHumanRange = 0.3;
+// Strength in m/s^2 and range in m of the repulsion from lines.
+const float kLineStrength = 10.0;
+const float kLineRange = 0.2;
+// Distances beyond which humans and lines are ignored. The cells of the
+// spatial hash are as large as the distance to other humans, so they are
+// all in the 3x3 cells around a human.
+const float kHumanCutoff = 2.0;
+const float kLineCutoff = 1.0;
+
+size_t Bucket(int x, int y, size_t num_buckets) {
+  const uint32_t h = static_cast<uint32_t>(x) * 73856093u ^
+      static_cast<uint32_t>(y) * 19349663u;
+  // The number of buckets is a power of two.
+  return h & (num_buckets - 1);
+}
+
+Vector2f ClosestPoint(const Line2f& l, const Vector2f& p) {
+  const Vector2f d = l.p1 - l.p0;
+  const float length_sq = d.squaredNorm();
+  if (length_sq == 0) return l.p0;
+  const float t = (p - l.p0).dot(d) / length_sq;
+  return l.p0 + std::max(0.0f, min(1.0f, t)) * d;
+}
+}  // namespace
+
+namespace human {
+
+Crowd::Crowd() : num_social_(0) {}
+
+void Crowd::Clear() {
+  x_.clear();
+  y_.clear();
+  angle_.clear();
+  vx_.clear();
+  vy_.clear();
+  goal_x_.clear();
+  goal_y_.clear();
+  start_x_.clear();
+  start_y_.clear();
+  goal_field_.clear();
+  start_field_.clear();
+  speed_.clear();
+  max_speed_.clear();
+  radius_.clear();
+  shape_.clear();
+  threshold_sq_.clear();
+  repeat_.clear();
+  arrived_.clear();
+  social_.clear();
+  num_social_ = 0;
+}
+
+int Crowd::Add(const HumanConfig& config) {
+  const Vector2f& start = config.start_pose.translation;
+  const Vector2f& goal = config.goal_pose.translation;
+  x_.push_back(start.x());
+  y_.push_back(start.y());
+  angle_.push_back(config.start_pose.angle);
+  vx_.push_back(0);
+  vy_.push_back(0);
+  goal_x_.push_back(goal.x());
+  goal_y_.push_back(goal.y());
+  start_x_.push_back(start.x());
+  start_y_.push_back(start.y());
+  goal_field_.push_back(-1);
+  start_field_.push_back(-1);
+  speed_.push_back(min(config.avg_speed, config.max_speed));
+  max_speed_.push_back(config.max_speed);
+  radius_.push_back(config.radius);
+  shape_.push_back(vector_map::CircleShape(config.radius));
+  threshold_sq_.push_back(
+      config.reach_goal_threshold * config.reach_goal_threshold);
+  repeat_.push_back(config.mode == HumanMode::Repeat);
+  arrived_.push_back(0);
+  social_.push_back(config.motion == HumanMotion::SocialForce);
+  if (social_.back()) ++num_social_;
+  return Size() - 1;
+}
+
+void Crowd::BuildHash() {
+  const int n = Size();
+  cell_x_.resize(n);
+  cell_y_.resize(n);
+  size_t num_buckets = 64;
+  while (num_buckets < 2 * static_cast<size_t>(n)) num_buckets *= 2;
+  bucket_start_.assign(num_buckets + 1, 0);
+  for (int i = 0; i < n; ++i) {
+    cell_x_[i] = floor(x_[i] / kHumanCutoff);
+    cell_y_[i] = floor(y_[i] / kHumanCutoff);
+    ++bucket_start_[Bucket(cell_x_[i], cell_y_[i], num_buckets) + 1];
+  }
+  for (size_t b = 0; b < num_buckets; ++b) {
+    bucket_start_[b + 1] += bucket_start_[b];
+  }
+  bucket_humans_.resize(n);
+  vector<int> fill(bucket_start_.begin(), bucket_start_.end() - 1);
+  for (int i = 0; i < n; ++i) {
+    const size_t b = Bucket(cell_x_[i], cell_y_[i], num_buckets);
+    bucket_humans_[fill[b]++] = i;
+  }
+}
+
+void Crowd::BuildFlowFields(const VectorMap& map,
+                            FlowFieldCache* flow_fields) {
+  for (int i = 0; i < Size(); ++i) {
+    goal_field_[i] = flow_fields->Get(Vector2f(goal_x_[i], goal_y_[i]), map);
+    start_field_[i] = repeat_[i] ?
+        flow_fields->Get(Vector2f(start_x_[i], start_y_[i]), map) : -1;
+  }
+  flow_fields->Save();
+}
+
+Vector2f Crowd::GoalDirection(int i, const FlowFieldCache* flow_fields) const {
+  const Vector2f p(x_[i], y_[i]);
+  Vector2f dir;
+  if (flow_fields != nullptr && goal_field_[i] >= 0 &&
+      flow_fields->Direction(goal_field_[i], p, &dir)) {
+    return dir;
+  }
+  const Vector2f to_goal(goal_x_[i] - p.x(), goal_y_[i] - p.y());
+  const float goal_dist = to_goal.norm();
+  return (goal_dist > 0) ? Vector2f(to_goal / goal_dist) : Vector2f(0, 0);
+}
+
+void Crowd::SocialForceVelocity(int i,
+                                float dt,
+                                const VectorMap& map,
+                                int first_id,
+                                const FlowFieldCache* flow_fields,
+                                vector<int>* candidates) {
+  if (arrived_[i]) {
+    vx_[i] = 0;
+    vy_[i] = 0;
+    return;
+  }
+  const Vector2f p(x_[i], y_[i]);
+  const Vector2f v(vx_[i], vy_[i]);
+  const Vector2f desired = speed_[i] * GoalDirection(i, flow_fields);
+  Vector2f force = (desired - v) / kRelaxationTime;
+
+  const size_t num_buckets = bucket_start_.size() - 1;
+  for (int y = cell_y_[i] - 1; y <= cell_y_[i] + 1; ++y) {
+    for (int x = cell_x_[i] - 1; x <= cell_x_[i] + 1; ++x) {
+      const size_t b = Bucket(x, y, num_buckets);
+      for (int k = bucket_start_[b]; k < bucket_start_[b + 1]; ++k) {
+        const int j = bucket_humans_[k];
+        // Skip humans that only share the bucket through a hash collision.
+        if (j == i || cell_x_[j] != x || cell_y_[j] != y) continue;
+        const Vector2f diff(x_[i] - x_[j], y_[i] - y_[j]);
+        const float dist = diff.norm();
+        if (dist >= kHumanCutoff || dist == 0) continue;
+        force += kHumanStrength *
+            exp((radius_[i] + radius_[j] - dist) / kHumanRange) / dist * diff;
+      }
+    }
+  }
+
+  const auto repel = [&](const Line2f& l) {
+    const Vector2f diff = p - ClosestPoint(l, p);
+    const float dist = diff.norm();
+    if (dist >= kLineCutoff || dist == 0) return;
+    force += kLineStrength * exp((radius_[i] - dist) / kLineRange) / dist *
+        diff;
+  };
+  const Vector2f box_min = p - Vector2f(kLineCutoff, kLineCutoff);
+  const Vector2f box_max = p + Vector2f(kLineCutoff, kLineCutoff);
+  if (map.IndexCurrent()) {
+    candidates->clear();
+    map.line_grid.QueryBox(box_min, box_max, candidates);
+    for (const int j : *candidates) {
+      repel(map.lines[j]);
+    }
+  } else {
+    for (const Line2f& l : map.lines) {
+      repel(l);
+    }
+  }
+  map.object_index.Query(box_min, box_max, [&](int id) {
+    if (id >= first_id) return;
+    const vector_map::ShapeView view = map.object_index.View(id);
+    for (int k = 0; k < view.NumLines(); ++k) {
+      repel(view.Line(k));
+    }
+    // Circles are other humans, so they repel like them.
+    for (int k = 0; k < view.NumCircles(); ++k) {
+      const vector_map::Circle c = view.GetCircle(k);
+      const Vector2f diff = p - c.center;
+      const float dist = diff.norm();
+      if (dist >= kHumanCutoff || dist == 0) continue;
+      force += kHumanStrength *
+          exp((radius_[i] + c.radius - dist) / kHumanRange) / dist * diff;
+    }
+  });
+
+  Vector2f new_v = v + dt * force;
+  const float speed = new_v.norm();
+  if (speed > max_speed_[i]) new_v *= max_speed_[i] / speed;
+  vx_[i] = new_v.x();
+  vy_[i] = new_v.y();
+}
+
+void Crowd::Step(float dt,
+                 const VectorMap& map,
+                 int first_id,
+                 const FlowFieldCache* flow_fields) {
+  const int n = Size();
+  if (num_social_ > 0) {
+    BuildHash();
+    int num_threads = 1;
+#ifdef _OPENMP
+    num_threads = omp_get_max_threads();
+#endif
+    if (static_cast<int>(thread_candidates_.size()) < num_threads) {
+      thread_candidates_.resize(num_threads);
+    }
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(dynamic, 64)
+#endif
+    for (int i = 0; i < n; ++i) {
+      if (!social_[i]) continue;
+      int thread = 0;
+#ifdef _OPENMP
+      thread = omp_get_thread_num();
+#endif
+      SocialForceVelocity(i, dt, map, first_id, flow_fields,
+                          &thread_candidates_[thread]);
+    }
+  }
+
+  float* x = x_.data();
+  float* y = y_.data();
+  float* vx = vx_.data();
+  float* vy = vy_.data();
+  float* goal_x = goal_x_.data();
+  float* goal_y = goal_y_.data();
+  float* start_x = start_x_.data();
+  float* start_y = start_y_.data();
+  const float* speed = speed_.data();
+  const float* threshold_sq = threshold_sq_.data();
+  const uint8_t* repeat = repeat_.data();
+  const uint8_t* social = social_.data();
+  uint8_t* arrived = arrived_.data();
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static)
+#endif
+  for (int i = 0; i < n; ++i) {
+    if (!social[i]) {
+      // Walk at the goal, ignoring anything in the way.
+      const float s = arrived[i] ? 0.0f : speed[i];
+      const Vector2f dir = GoalDirection(i, flow_fields);
+      vx[i] = s * dir.x();
+      vy[i] = s * dir.y();
+    }
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+    const float ex = goal_x[i] - x[i];
+    const float ey = goal_y[i] - y[i];
+    if (!arrived[i] && ex * ex + ey * ey < threshold_sq[i]) {
+      if (repeat[i]) {
+        swap(goal_x[i], start_x[i]);
+        swap(goal_y[i], start_y[i]);
+        swap(goal_field_[i], start_field_[i]);
+      } else {
+        arrived[i] = 1;
+        vx[i] = 0;
+        vy[i] = 0;
+      }
+    }
+  }
+}
+
+}  // namespace human
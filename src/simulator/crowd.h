@@ -0,0 +1,156 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    crowd.h
+\brief   Structure-of-arrays simulation of many humans.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+#include "math/poses_2d.h"
+
+#include "flow_field.h"
+#include "human_object.h"
+#include "shape.h"
+#include "vector_map.h"
+
+#ifndef SRC_SIMULATOR_CROWD_H_
+#define SRC_SIMULATOR_CROWD_H_
+
+namespace human {
+
+// Humans that walk between their start and goal poses, like HumanObject,
+// stored as arrays of each of their properties instead of one object each,
+// so that thousands of them can be stepped in one vectorized, multi-threaded
+// pass. Each human is a circle, which the ray caster intersects exactly.
+//
+// Humans with SocialForce motion are steered by the social force model of
+// Helbing and Molnar: they accelerate towards their goal, and are pushed
+// away from nearby humans, map lines and object shapes. Other humans are
+// found through a spatial hash over their positions that is rebuilt every
+// step, and lines through the indices of the map, so a step costs time
+// linear in the number of humans. The forces only look at the surroundings
+// of a human, so to route around walls, humans can follow shared flow fields
+// towards their goals instead of heading straight at them.
+class Crowd {
+ public:
+  Crowd();
+
+  // Remove all humans.
+  void Clear();
+
+  // Add a human, and return its index.
+  int Add(const HumanConfig& config);
+
+  // Move all humans towards their goals for dt seconds. Humans in Repeat
+  // mode swap their start and goal when they reach the goal, and humans in
+  // Singleshot mode stop there. Social force humans avoid the lines of map,
+  // and the shapes of its objects with ids below first_id, above which the
+  // map holds the circles of the crowd itself. If flow_fields is set, humans
+  // head along its fields towards their goals, which must have been built
+  // with BuildFlowFields.
+  void Step(float dt,
+            const vector_map::VectorMap& map,
+            int first_id,
+            const vector_map::FlowFieldCache* flow_fields);
+
+  // Find the flow fields over map towards the goals of all humans, and the
+  // starts of humans in Repeat mode, computing the missing fields. Computing
+  // a field takes much longer than a step, so this is called when humans are
+  // added or flow_fields is reset, instead of during steps.
+  void BuildFlowFields(const vector_map::VectorMap& map,
+                       vector_map::FlowFieldCache* flow_fields);
+
+  int Size() const { return static_cast<int>(x_.size()); }
+
+  pose_2d::Pose2Df GetPose(int i) const {
+    return pose_2d::Pose2Df(angle_[i], Eigen::Vector2f(x_[i], y_[i]));
+  }
+
+  Eigen::Vector2f GetVel(int i) const {
+    return Eigen::Vector2f(vx_[i], vy_[i]);
+  }
+
+  // True if human i is in Singleshot mode and has reached its goal.
+  bool Arrived(int i) const { return arrived_[i] != 0; }
+
+  // Shape of human i, a circle shared by all humans of the same radius.
+  const std::shared_ptr<const vector_map::Shape>& GetShape(int i) const {
+    return shape_[i];
+  }
+
+ private:
+  // Index humans by their cells in the spatial hash.
+  void BuildHash();
+
+  // Unit direction in which human i heads towards its goal.
+  Eigen::Vector2f GoalDirection(
+      int i, const vector_map::FlowFieldCache* flow_fields) const;
+
+  // Set the velocity of social force human i over the next step of dt
+  // seconds, using the candidates buffer for line queries.
+  void SocialForceVelocity(int i,
+                           float dt,
+                           const vector_map::VectorMap& map,
+                           int first_id,
+                           const vector_map::FlowFieldCache* flow_fields,
+                           std::vector<int>* candidates);
+
+  // Current pose.
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> angle_;
+  // Velocity over the last step.
+  std::vector<float> vx_;
+  std::vector<float> vy_;
+  // Goal, and the start it returns to in Repeat mode.
+  std::vector<float> goal_x_;
+  std::vector<float> goal_y_;
+  std::vector<float> start_x_;
+  std::vector<float> start_y_;
+  // Flow fields towards the goal and the start, or -1 if not looked up yet.
+  std::vector<int> goal_field_;
+  std::vector<int> start_field_;
+  // Walking speed, the average speed clipped to the maximum speed.
+  std::vector<float> speed_;
+  std::vector<float> max_speed_;
+  std::vector<float> radius_;
+  std::vector<std::shared_ptr<const vector_map::Shape>> shape_;
+  // Square of the distance to the goal at which it is reached.
+  std::vector<float> threshold_sq_;
+  std::vector<uint8_t> repeat_;
+  std::vector<uint8_t> arrived_;
+  std::vector<uint8_t> social_;
+  int num_social_;
+  // Spatial hash over the positions of humans. Human i is in cell
+  // (cell_x_[i], cell_y_[i]), and the humans in bucket b are
+  // bucket_humans_[bucket_start_[b], bucket_start_[b + 1]).
+  std::vector<int> cell_x_;
+  std::vector<int> cell_y_;
+  std::vector<int> bucket_start_;
+  std::vector<int> bucket_humans_;
+  // Line query buffers of each thread.
+  std::vector<std::vector<int>> thread_candidates_;
+};
+
+}  // namespace human
+
+#endif  // SRC_SIMULATOR_CROWD_H_
@@ -0,0 +1,122 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    crowd_benchmark.cpp
+\brief   Benchmark of the crowd step time against the crowd size.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+
+#include "shared/math/line2d.h"
+#include "shared/util/timer.h"
+#include "simulator/crowd.h"
+#include "simulator/vector_map.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using human::Crowd;
+using human::HumanConfig;
+using pose_2d::Pose2Df;
+using std::string;
+using std::vector;
+using vector_map::VectorMap;
+
+DEFINE_string(map, "", "Vector map to walk in, or empty for open space.");
+DEFINE_string(sizes, "100,1000,10000", "Comma-separated crowd sizes.");
+DEFINE_int32(steps, 200, "Number of steps to time for each crowd size.");
+DEFINE_double(density, 0.2, "Humans per square meter in open space.");
+DEFINE_double(dt, 0.025, "Step size in seconds.");
+DEFINE_int32(seed, 1, "Seed for the start and goal positions.");
+
+// Time per step, in ms, of a crowd of num_humans with the given motion,
+// including the update of their poses in the object index of map.
+double TimeStep(int num_humans, human::HumanMotion motion, VectorMap* map) {
+  Vector2f box_min(0, 0);
+  Vector2f box_max(0, 0);
+  if (map->lines.empty()) {
+    const float side = sqrt(num_humans / FLAGS_density);
+    box_max = Vector2f(side, side);
+  } else {
+    box_min = map->lines[0].p0;
+    box_max = map->lines[0].p0;
+    for (const Line2f& l : map->lines) {
+      box_min = box_min.cwiseMin(l.p0).cwiseMin(l.p1);
+      box_max = box_max.cwiseMax(l.p0).cwiseMax(l.p1);
+    }
+  }
+  std::mt19937 rng(FLAGS_seed);
+  std::uniform_real_distribution<float> x(box_min.x(), box_max.x());
+  std::uniform_real_distribution<float> y(box_min.y(), box_max.y());
+
+  Crowd crowd;
+  HumanConfig config;
+  config.radius = 0.2;
+  config.max_speed = 1.5;
+  config.avg_speed = 1.0;
+  config.max_omega = 0.2;
+  config.avg_omega = 0;
+  config.reach_goal_threshold = 0.3;
+  config.mode = human::HumanMode::Repeat;
+  config.motion = motion;
+  for (int i = 0; i < num_humans; ++i) {
+    config.start_pose = Pose2Df(0, Vector2f(x(rng), y(rng)));
+    config.goal_pose = Pose2Df(0, Vector2f(x(rng), y(rng)));
+    crowd.Add(config);
+  }
+
+  map->object_index.Clear();
+  const double t_start = GetMonotonicTime();
+  for (int step = 0; step < FLAGS_steps; ++step) {
+    crowd.Step(FLAGS_dt, *map, 0, nullptr);
+    for (int i = 0; i < crowd.Size(); ++i) {
+      map->object_index.Update(i, crowd.GetShape(i), crowd.GetPose(i));
+    }
+  }
+  return 1000.0 * (GetMonotonicTime() - t_start) / FLAGS_steps;
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  VectorMap map;
+  if (!FLAGS_map.empty() && !map.Load(FLAGS_map, false)) return 1;
+  printf("%10s %14s %14s\n", "humans", "direct ms", "social ms");
+  const char* sizes = FLAGS_sizes.c_str();
+  while (*sizes != '\0') {
+    char* end = nullptr;
+    const int num_humans = strtol(sizes, &end, 10);
+    if (end == sizes || num_humans <= 0) {
+      fprintf(stderr, "ERROR: Invalid crowd sizes '%s'\n",
+              FLAGS_sizes.c_str());
+      return 1;
+    }
+    printf("%10d %14.3f %14.3f\n",
+           num_humans,
+           TimeStep(num_humans, human::HumanMotion::Direct, &map),
+           TimeStep(num_humans, human::HumanMotion::SocialForce, &map));
+    fflush(stdout);
+    sizes = (*end == ',') ? end + 1 : end;
+  }
+  return 0;
+}
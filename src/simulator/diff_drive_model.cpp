@@ -29,7 +29,6 @@
 #include <geometry_msgs/Twist.h>
 #include <nav_msgs/Odometry.h>
 #include "diff_drive_model.h"
-#include "shared/util/timer.h"
 
 using Eigen::Vector2f;
 using Eigen::Vector3f;
@@ -82,7 +81,7 @@ DiffDriveModel::DiffDriveModel(const vector<string>& config_files,
 
 void DiffDriveModel::Step(const double &dt) {
   // TODO(joydeepb): Make the 0.1 either a flag or config.
-  if (t_last_cmd_ < GetMonotonicTime() - 0.1) {
+  if (t_last_cmd_ < sim_time_ - 0.1) {
     target_angular_vel_ = 0;
     target_linear_vel_ = 0;
   }
@@ -139,15 +138,18 @@ void DiffDriveModel::Step(const double &dt) {
     vel_.angle = angular_vel_;
     pose_.translation += geometry::Heading(pose_.angle) * dx;
     pose_.angle = AngleMod(pose_.angle + vel_.angle * dt);
-
-    // Create a Quaternion from the angle
-    quat_ = tf::createQuaternionMsgFromYaw(pose_.angle);
     last_time_ = current_time;
+}
 
-    PublishOdom(dt);
+void DiffDriveModel::Stop() {
+    RobotModel::Stop();
+    linear_vel_ = 0.0;
+    angular_vel_ = 0.0;
 }
 
 void DiffDriveModel::PublishOdom(const float dt) {
+    // Create a Quaternion from the angle
+    quat_ = tf::createQuaternionMsgFromYaw(pose_.angle);
     odom_msg_.header.stamp = last_time_;
     odom_msg_.pose.pose.position.x = pose_.translation.x();
     odom_msg_.pose.pose.position.y = pose_.translation.y();
@@ -169,7 +171,8 @@ void DiffDriveModel::PublishOdom(const float dt) {
 
 void DiffDriveModel::DriveCallback(const geometry_msgs::Twist& msg) {
     last_cmd_ = msg;
-    t_last_cmd_ = GetMonotonicTime();
+    t_last_cmd_ = sim_time_;
+    ++command_count_;
     double x = msg.linear.x, z = msg.angular.z;
 
     // invert motion, if needed
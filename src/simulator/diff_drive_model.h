@@ -44,6 +44,8 @@ class DiffDriveModel : public robot_model::RobotModel {
   ~DiffDriveModel() = default;
   // define Step function for updating
   void Step(const double& dt);
+  // Also clears the velocities ramping towards the commanded ones.
+  void Stop();
   void PublishOdom(const float dt);
 };
 
@@ -36,10 +36,10 @@ Pose2Df EntityBase::GetPose() {
   return pose_;
 }
 
-std::vector<geometry::Line2f> EntityBase::GetTemplateLines() {
-  return template_lines_;
+const std::shared_ptr<const vector_map::Shape>& EntityBase::GetShape() {
+  return shape_;
 }
 
-std::vector<geometry::Line2f> EntityBase::GetLines() {
-  return pose_lines_;
+vector_map::ShapeView EntityBase::GetView() {
+  return vector_map::ShapeView(shape_.get(), pose_);
 }
@@ -21,11 +21,13 @@
 //========================================================================
 
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <cmath>
 #include "eigen3/Eigen/Dense"
 #include "shared/math/line2d.h"
 #include "shared/math/poses_2d.h"
+#include "simulator/shape.h"
 #ifndef SRC_SIMULATOR_ENTITY_BASE_H_
 #define SRC_SIMULATOR_ENTITY_BASE_H_
 
@@ -34,10 +36,9 @@ using pose_2d::Pose2Df;
 class EntityBase{
  protected:
     Pose2Df pose_;
-    // template lines always assuming at pose (0., 0., 0.)
-    std::vector<geometry::Line2f> template_lines_;
-    // actual line position given current pose pose_
-    std::vector<geometry::Line2f> pose_lines_;
+    // shape assuming at pose (0., 0., 0.), shared with other entities of the
+    // same kind, and only moved to pose_ when read
+    std::shared_ptr<const vector_map::Shape> shape_;
  public:
     EntityBase();
     virtual ~EntityBase() = default;
@@ -47,10 +48,10 @@ class EntityBase{
     virtual void SetPose(const Pose2Df& pose);
     // get current  pose of the obstacle
     virtual Pose2Df GetPose();
-    // get current shape (lines) based on the pose
-    virtual std::vector<geometry::Line2f> GetLines();
     // get template shape
-    virtual std::vector<geometry::Line2f> GetTemplateLines();
+    virtual const std::shared_ptr<const vector_map::Shape>& GetShape();
+    // get current shape based on the pose, without copying it
+    virtual vector_map::ShapeView GetView();
 };
 
 #endif  // SRC_SIMULATOR_ENTITY_BASE_H_
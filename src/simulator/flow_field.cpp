@@ -0,0 +1,381 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    flow_field.cpp
+\brief   Flow fields towards goals around the static lines of a map.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "flow_field.h"
+#include "map_cache.h"
+#include "visibility_cache.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using std::max;
+using std::min;
+using std::pair;
+using std::string;
+using std::vector;
+
+namespace {
+// Identifies the flow field file format, and its version.
+const uint32_t kFieldMagic = 0x574c4646;  // "FFLW"
+const uint32_t kFieldVersion = 1;
+
+struct FieldHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t lines_hash;
+  uint64_t num_lines;
+  float cell_size;
+  float clearance;
+  float origin_x;
+  float origin_y;
+  int32_t width;
+  int32_t height;
+  uint64_t num_fields;
+};
+
+// Neighbors of a cell, counter-clockwise from +x, and the direction to each.
+const int kNeighborX[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+const int kNeighborY[8] = {0, 1, 1, 1, 0, -1, -1, -1};
+const float kSqrtHalf = 0.70710678;
+const Vector2f kDirections[8] = {
+  Vector2f(1, 0), Vector2f(kSqrtHalf, kSqrtHalf),
+  Vector2f(0, 1), Vector2f(-kSqrtHalf, kSqrtHalf),
+  Vector2f(-1, 0), Vector2f(-kSqrtHalf, -kSqrtHalf),
+  Vector2f(0, -1), Vector2f(kSqrtHalf, -kSqrtHalf),
+};
+// Special values of the next neighbor of a cell.
+const uint8_t kGoalCell = 8;
+const uint8_t kUnreachable = 255;
+// Limit on the number of fields in a file, to reject corrupt files.
+const uint64_t kMaxFields = 1 << 20;
+
+// True if the segment from p0 to p1 intersects the box [box_min, box_max].
+bool SegmentIntersectsBox(const Vector2f& p0,
+                          const Vector2f& p1,
+                          const Vector2f& box_min,
+                          const Vector2f& box_max) {
+  // Clip the segment p0 + t * d, for t in [0, 1], to the box.
+  const Vector2f d = p1 - p0;
+  float t0 = 0;
+  float t1 = 1;
+  for (int k = 0; k < 2; ++k) {
+    if (d[k] == 0) {
+      if (p0[k] < box_min[k] || p0[k] > box_max[k]) return false;
+      continue;
+    }
+    float ta = (box_min[k] - p0[k]) / d[k];
+    float tb = (box_max[k] - p0[k]) / d[k];
+    if (ta > tb) std::swap(ta, tb);
+    t0 = max(t0, ta);
+    t1 = min(t1, tb);
+    if (t0 > t1) return false;
+  }
+  return true;
+}
+}  // namespace
+
+namespace vector_map {
+
+FlowFieldCache::FlowFieldCache(float cell_size, float clearance) :
+    cell_size_(cell_size),
+    clearance_(clearance),
+    lines_hash_(0),
+    num_lines_(0),
+    grid_built_(false),
+    changed_(false),
+    origin_(0, 0),
+    width_(0),
+    height_(0) {}
+
+uint64_t FlowFieldCache::CellKey(int x, int y) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) |
+      static_cast<uint32_t>(y);
+}
+
+void FlowFieldCache::Reset(const VectorMap& map, bool persist) {
+  fields_.clear();
+  field_index_.clear();
+  blocked_.clear();
+  grid_built_ = false;
+  changed_ = false;
+  width_ = 0;
+  height_ = 0;
+  num_lines_ = map.lines.size();
+  lines_hash_ = VisibilityCache::HashLines(map.lines);
+  file_.clear();
+  if (map.lines.empty()) return;
+  Vector2f box_min = map.lines[0].p0;
+  Vector2f box_max = map.lines[0].p0;
+  for (const Line2f& l : map.lines) {
+    box_min = box_min.cwiseMin(l.p0).cwiseMin(l.p1);
+    box_max = box_max.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  // Leave room around the lines to walk around them.
+  const float margin = clearance_ + 2.0 * cell_size_;
+  origin_ = box_min - Vector2f(margin, margin);
+  width_ = static_cast<int>(ceil((box_max.x() + margin - origin_.x()) /
+                                 cell_size_));
+  height_ = static_cast<int>(ceil((box_max.y() + margin - origin_.y()) /
+                                  cell_size_));
+  if (persist && !map.file_name.empty()) {
+    file_ = MapSideFileName(map.file_name, ".flowfield.bin");
+    Load(file_);
+  }
+}
+
+void FlowFieldCache::BuildGrid(const VectorMap& map) {
+  blocked_.assign(static_cast<size_t>(width_) * height_, 0);
+  const Vector2f clearance(clearance_, clearance_);
+  for (const Line2f& l : map.lines) {
+    const Vector2f line_min = l.p0.cwiseMin(l.p1) - clearance;
+    const Vector2f line_max = l.p0.cwiseMax(l.p1) + clearance;
+    const int x0 = max(0, static_cast<int>(
+        floor((line_min.x() - origin_.x()) / cell_size_)));
+    const int y0 = max(0, static_cast<int>(
+        floor((line_min.y() - origin_.y()) / cell_size_)));
+    const int x1 = min(width_ - 1, static_cast<int>(
+        floor((line_max.x() - origin_.x()) / cell_size_)));
+    const int y1 = min(height_ - 1, static_cast<int>(
+        floor((line_max.y() - origin_.y()) / cell_size_)));
+    for (int y = y0; y <= y1; ++y) {
+      for (int x = x0; x <= x1; ++x) {
+        const Vector2f cell_min = origin_ + cell_size_ * Vector2f(x, y);
+        const Vector2f cell_max = cell_min + Vector2f(cell_size_, cell_size_);
+        // Approximates the cells within clearance of the line by expanding
+        // the cell by the clearance.
+        if (SegmentIntersectsBox(l.p0, l.p1,
+                                 cell_min - clearance,
+                                 cell_max + clearance)) {
+          blocked_[y * width_ + x] = 1;
+        }
+      }
+    }
+  }
+  grid_built_ = true;
+}
+
+void FlowFieldCache::BuildField(Field* field) const {
+  const int num_cells = width_ * height_;
+  const float kInf = std::numeric_limits<float>::infinity();
+  const float kDiagonal = sqrt(2.0);
+  vector<float> dist(num_cells, kInf);
+  // Whether the move from cell (x, y) to neighbor k stays clear of lines,
+  // without cutting the corners of blocked cells.
+  const auto can_move = [&](int x, int y, int k) {
+    const int nx = x + kNeighborX[k];
+    const int ny = y + kNeighborY[k];
+    if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) return false;
+    if (blocked_[ny * width_ + nx]) return false;
+    if ((k & 1) == 0) return true;
+    return !blocked_[y * width_ + nx] && !blocked_[ny * width_ + x];
+  };
+
+  typedef pair<float, int> QueueEntry;
+  std::priority_queue<QueueEntry,
+                      vector<QueueEntry>,
+                      std::greater<QueueEntry>> queue;
+  const int goal = field->goal_y * width_ + field->goal_x;
+  dist[goal] = 0;
+  queue.push(QueueEntry(0, goal));
+  while (!queue.empty()) {
+    const QueueEntry top = queue.top();
+    queue.pop();
+    const int c = top.second;
+    if (top.first > dist[c]) continue;
+    const int x = c % width_;
+    const int y = c / width_;
+    // Moves are allowed both ways or neither, so searching outwards from the
+    // goal finds the shortest paths to it.
+    for (int k = 0; k < 8; ++k) {
+      const int nx = x + kNeighborX[k];
+      const int ny = y + kNeighborY[k];
+      if (!can_move(x, y, k)) continue;
+      const int n = ny * width_ + nx;
+      const float d = top.first + (((k & 1) == 0) ? 1.0f : kDiagonal);
+      if (d < dist[n]) {
+        dist[n] = d;
+        queue.push(QueueEntry(d, n));
+      }
+    }
+  }
+
+  field->next.assign(num_cells, kUnreachable);
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      const int c = y * width_ + x;
+      if (c == goal) {
+        field->next[c] = kGoalCell;
+        continue;
+      }
+      // Blocked cells lead out to the nearest free cell on a path to the
+      // goal, so that entities pushed against lines find their way back.
+      const bool blocked = blocked_[c];
+      float best = kInf;
+      for (int k = 0; k < 8; ++k) {
+        const int nx = x + kNeighborX[k];
+        const int ny = y + kNeighborY[k];
+        if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+        if (!blocked && !can_move(x, y, k) && ny * width_ + nx != goal) {
+          continue;
+        }
+        const float d = dist[ny * width_ + nx] +
+            (((k & 1) == 0) ? 1.0f : kDiagonal);
+        if (d < best) {
+          best = d;
+          field->next[c] = k;
+        }
+      }
+    }
+  }
+}
+
+int FlowFieldCache::Get(const Vector2f& goal, const VectorMap& map) {
+  if (width_ == 0 || height_ == 0) return -1;
+  const int x = min(width_ - 1, max(0, static_cast<int>(
+      floor((goal.x() - origin_.x()) / cell_size_))));
+  const int y = min(height_ - 1, max(0, static_cast<int>(
+      floor((goal.y() - origin_.y()) / cell_size_))));
+  const uint64_t key = CellKey(x, y);
+  const auto it = field_index_.find(key);
+  if (it != field_index_.end()) return it->second;
+
+  if (!grid_built_) BuildGrid(map);
+  Field field;
+  field.goal_x = x;
+  field.goal_y = y;
+  BuildField(&field);
+  fields_.push_back(field);
+  field_index_[key] = fields_.size() - 1;
+  changed_ = true;
+  return fields_.size() - 1;
+}
+
+bool FlowFieldCache::Direction(int i,
+                               const Vector2f& loc,
+                               Vector2f* dir) const {
+  const int x = static_cast<int>(floor((loc.x() - origin_.x()) / cell_size_));
+  const int y = static_cast<int>(floor((loc.y() - origin_.y()) / cell_size_));
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return false;
+  const uint8_t next = fields_[i].next[y * width_ + x];
+  if (next >= kGoalCell) return false;
+  *dir = kDirections[next];
+  return true;
+}
+
+void FlowFieldCache::Save() {
+  if (file_.empty() || !changed_) return;
+  FieldHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kFieldMagic;
+  header.version = kFieldVersion;
+  header.lines_hash = lines_hash_;
+  header.num_lines = num_lines_;
+  header.cell_size = cell_size_;
+  header.clearance = clearance_;
+  header.origin_x = origin_.x();
+  header.origin_y = origin_.y();
+  header.width = width_;
+  header.height = height_;
+  header.num_fields = fields_.size();
+  // Write under a temporary name and rename, so that concurrent simulator
+  // instances never read a partial file.
+  const string tmp_file = file_ + ".tmp" + std::to_string(getpid());
+  FILE* fid = fopen(tmp_file.c_str(), "wb");
+  if (fid == NULL) {
+    fprintf(stderr, "WARNING: Unable to save flow fields %s\n",
+            file_.c_str());
+    return;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, fid) == 1);
+  for (const Field& field : fields_) {
+    const int32_t goal[2] = {field.goal_x, field.goal_y};
+    ok = ok && (fwrite(goal, sizeof(goal), 1, fid) == 1);
+    ok = ok && (fwrite(field.next.data(), 1, field.next.size(), fid) ==
+                field.next.size());
+  }
+  ok = (fclose(fid) == 0) && ok;
+  ok = ok && (rename(tmp_file.c_str(), file_.c_str()) == 0);
+  if (!ok) {
+    remove(tmp_file.c_str());
+    fprintf(stderr, "WARNING: Unable to save flow fields %s\n",
+            file_.c_str());
+    return;
+  }
+  changed_ = false;
+}
+
+bool FlowFieldCache::Load(const string& file) {
+  FILE* fid = fopen(file.c_str(), "rb");
+  if (fid == NULL) return false;
+  FieldHeader header;
+  if (fread(&header, sizeof(header), 1, fid) != 1 ||
+      header.magic != kFieldMagic ||
+      header.version != kFieldVersion ||
+      header.lines_hash != lines_hash_ ||
+      header.num_lines != num_lines_ ||
+      header.cell_size != cell_size_ ||
+      header.clearance != clearance_ ||
+      header.origin_x != origin_.x() ||
+      header.origin_y != origin_.y() ||
+      header.width != width_ ||
+      header.height != height_ ||
+      header.num_fields > kMaxFields) {
+    fclose(fid);
+    return false;
+  }
+  const size_t num_cells = static_cast<size_t>(width_) * height_;
+  vector<Field> fields(header.num_fields);
+  bool ok = true;
+  for (Field& field : fields) {
+    int32_t goal[2];
+    field.next.resize(num_cells);
+    ok = ok && fread(goal, sizeof(goal), 1, fid) == 1 &&
+        goal[0] >= 0 && goal[0] < width_ && goal[1] >= 0 && goal[1] < height_ &&
+        fread(field.next.data(), 1, num_cells, fid) == num_cells;
+    if (!ok) break;
+    field.goal_x = goal[0];
+    field.goal_y = goal[1];
+  }
+  fclose(fid);
+  if (!ok) return false;
+  fields_.swap(fields);
+  for (size_t i = 0; i < fields_.size(); ++i) {
+    field_index_[CellKey(fields_[i].goal_x, fields_[i].goal_y)] = i;
+  }
+  return true;
+}
+
+}  // namespace vector_map
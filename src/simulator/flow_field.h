@@ -0,0 +1,108 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    flow_field.h
+\brief   Flow fields towards goals around the static lines of a map.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "vector_map.h"
+
+#ifndef SRC_SIMULATOR_FLOW_FIELD_H_
+#define SRC_SIMULATOR_FLOW_FIELD_H_
+
+namespace vector_map {
+
+// Flow fields over a grid covering the static lines of a map, one for each
+// goal cell. Each cell of a field stores which of its 8 neighbors is next on
+// a shortest path to the goal that keeps a clearance from the lines, so
+// every entity heading to the same goal shares the field, and finding the
+// direction to walk in is a lookup. Fields are computed the first time they
+// are asked for, with Dijkstra's algorithm, which is too slow to do during a
+// step, and can be saved next to the map file so that later runs load them
+// instead.
+class FlowFieldCache {
+ public:
+  // Fields have square cells of side cell_size, and cells closer than
+  // clearance to a line are blocked.
+  FlowFieldCache(float cell_size, float clearance);
+
+  // Remove all fields, and compute new fields for map. If persist is set,
+  // the fields saved next to the map file are loaded, and Save writes new
+  // fields there.
+  void Reset(const VectorMap& map, bool persist);
+
+  // Index of the field towards goal, computing it over map, which must be
+  // the map of the last Reset, if there is no field for the cell of goal
+  // yet. Returns -1 if the map has no lines.
+  int Get(const Eigen::Vector2f& goal, const VectorMap& map);
+
+  // Unit direction to walk in from loc to follow field i. Returns false if
+  // loc is outside the grid, in the goal cell, or cannot reach the goal, in
+  // which case the goal should be walked to directly.
+  bool Direction(int i, const Eigen::Vector2f& loc, Eigen::Vector2f* dir) const;
+
+  int NumFields() const { return static_cast<int>(fields_.size()); }
+
+  // Save the fields next to the map, if they are persisted and fields were
+  // added since they were loaded or last saved.
+  void Save();
+
+ private:
+  struct Field {
+    int32_t goal_x;
+    int32_t goal_y;
+    // For each cell, the index of the next neighbor in kNeighbors, or one of
+    // the special values in flow_field.cpp.
+    std::vector<uint8_t> next;
+  };
+
+  // Set up the grid and find the blocked cells.
+  void BuildGrid(const VectorMap& map);
+  void BuildField(Field* field) const;
+  bool Load(const std::string& file);
+
+  static uint64_t CellKey(int x, int y);
+
+  const float cell_size_;
+  const float clearance_;
+  // Hash of the map lines, to validate saved fields against.
+  uint64_t lines_hash_;
+  size_t num_lines_;
+  // File the fields are saved to, or empty if they are not persisted.
+  std::string file_;
+  bool grid_built_;
+  bool changed_;
+  Eigen::Vector2f origin_;
+  int width_;
+  int height_;
+  // Whether each cell is blocked by a line.
+  std::vector<uint8_t> blocked_;
+  std::vector<Field> fields_;
+  // Index in fields_ of the field of each goal cell.
+  std::unordered_map<uint64_t, int> field_index_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_FLOW_FIELD_H_
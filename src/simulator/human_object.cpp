@@ -28,7 +28,6 @@ using std::vector;
 namespace human{
 
 CONFIG_FLOAT(radius, "hu_radius");
-CONFIG_FLOAT(num_segments, "hu_num_segments");
 CONFIG_FLOAT(start_x, "hu_start_x");
 CONFIG_FLOAT(start_y, "hu_start_y");
 CONFIG_FLOAT(start_theta, "hu_start_theta");
@@ -41,6 +40,18 @@ CONFIG_FLOAT(max_omega, "hu_max_omega");
 CONFIG_FLOAT(avg_omega, "hu_avg_omega");
 CONFIG_FLOAT(reach_goal_threshold, "hu_reach_goal_threshold");
 CONFIG_INT(mode, "hu_mode");
+CONFIG_INT(motion, "hu_motion");
+
+// Config file with the values of the optional keys, which each human config
+// file is loaded after, so that keys missing from it keep these values.
+static const char kHumanDefaultsFile[] = "config/human_defaults.lua";
+
+// The config files of a human, after the defaults.
+static vector<string> WithDefaults(const vector<string>& config_file) {
+  vector<string> files = {kHumanDefaultsFile};
+  files.insert(files.end(), config_file.begin(), config_file.end());
+  return files;
+}
 
 /* HumanObject::HumanObject() {
   // angle, (x, y)
@@ -67,6 +78,24 @@ CONFIG_INT(mode, "hu_mode");
   this->Initialize();
 }
  */
+
+HumanConfig ReadHumanConfig(const vector<string>& config_file) {
+  config_reader::ConfigReader reader(WithDefaults(config_file));
+  HumanConfig config;
+  config.start_pose =
+      Pose2Df(CONFIG_start_theta, {CONFIG_start_x, CONFIG_start_y});
+  config.goal_pose = Pose2Df(CONFIG_goal_theta, {CONFIG_goal_x, CONFIG_goal_y});
+  config.radius = CONFIG_radius;
+  config.max_speed = CONFIG_max_speed;
+  config.avg_speed = CONFIG_avg_speed;
+  config.max_omega = CONFIG_max_omega;
+  config.avg_omega = CONFIG_avg_omega;
+  config.reach_goal_threshold = CONFIG_reach_goal_threshold;
+  config.mode = static_cast<HumanMode>(CONFIG_mode);
+  config.motion = static_cast<HumanMotion>(CONFIG_motion);
+  return config;
+}
+
 HumanObject::HumanObject(const vector<string>& config_file) :
     EntityBase(),
     start_pose_(),
@@ -79,7 +108,7 @@ HumanObject::HumanObject(const vector<string>& config_file) :
     avg_omega_(0.),
     mode_(HumanMode::Repeat),
     reach_goal_threshold_(0.3),
-    config_reader_(config_file){
+    config_reader_(WithDefaults(config_file)){
   
   start_pose_ = Pose2Df(CONFIG_start_theta, {CONFIG_start_x, CONFIG_start_y});
   pose_ = start_pose_;
@@ -91,25 +120,8 @@ HumanObject::HumanObject(const vector<string>& config_file) :
   reach_goal_threshold_ = CONFIG_reach_goal_threshold;
   mode_ = static_cast<HumanMode>(CONFIG_mode);
 
-  // just a cylinder for now
-  const float r = CONFIG_radius;
-  const int num_segments = CONFIG_num_segments;
-
-  const float angle_increment = 2 * M_PI / num_segments;
-
-  Eigen::Vector2f v0(r, 0.);
-  Eigen::Vector2f v1;
-  const float eps = 0.001;
-  for (int i = 1; i < num_segments; i++) {
-    v1 = Eigen::Rotation2Df(angle_increment * i) * Eigen::Vector2f(r, 0.0);
-
-    // TODO(yifeng): Fix the vector map bug that closed shape would have wrong occlusion
-    Eigen::Vector2f eps_vec = (v1 - v0).normalized() * eps;
-    template_lines_.push_back(geometry::Line2f(v0 + eps_vec, v1 - eps_vec));
-    v0 = v1;
-  }
-  template_lines_.push_back(geometry::Line2f(v1, Eigen::Vector2f(r, 0.0)));
-  pose_lines_ = template_lines_;
+  // just a cylinder for now, which the ray caster intersects exactly
+  shape_ = vector_map::CircleShape(CONFIG_radius);
 }
 
 
@@ -121,24 +133,6 @@ void HumanObject::SetGoalPose(const Pose2Df& goal_pose) {
   goal_pose_ = goal_pose;
 }
 
-void HumanObject::SetPose(const Pose2Df& pose) {
-  pose_ = pose;
-  // update the shape according to the new pose
-  // this->Initialize();
-  this->Transform();
-}
-
-void HumanObject::Transform() {
-  Eigen::Rotation2Df R(math_util::AngleMod(pose_.angle));
-  Eigen::Vector2f T = pose_.translation;
-
-  for (size_t i=0; i < template_lines_.size(); i++) {
-    pose_lines_[i].p0 = R * (template_lines_[i].p0) + T;
-    pose_lines_[i].p1 = R * (template_lines_[i].p1) + T;
-  }
-}
-
-
 void HumanObject::SetVel(const Eigen::Vector2f& trans_vel, const double& rot_vel) {
   trans_vel_ = trans_vel;
   rot_vel_ = rot_vel;
@@ -156,7 +150,6 @@ void HumanObject::Step(const double& dt) {
 
   pose_.Set(pose_.angle + rot_vel_ * dt, pose_.translation + trans_vel_ * dt);
 
-  this->Transform();
   this->CheckReachGoal();
 }
 
@@ -37,6 +37,33 @@ enum HumanMode{
      Repeat
 };
 
+// How a human steers towards its goal.
+enum HumanMotion {
+     // Walk at the goal, or along the flow field towards it, through
+     // anything in the way.
+     Direct,
+     // Social force model, where the human is pushed away from walls,
+     // robots and other humans. Only supported by the crowd engine.
+     SocialForce
+};
+
+// Shape and motion of a human, as read from a human config file.
+struct HumanConfig {
+  Pose2Df start_pose;
+  Pose2Df goal_pose;
+  float radius;
+  float max_speed;
+  float avg_speed;
+  float max_omega;
+  float avg_omega;
+  float reach_goal_threshold;
+  HumanMode mode;
+  HumanMotion motion;
+};
+
+// Read the human config file.
+HumanConfig ReadHumanConfig(const std::vector<std::string>& config_file);
+
 class HumanObject: public EntityBase{
  protected:
   Pose2Df start_pose_;
@@ -68,14 +95,11 @@ class HumanObject: public EntityBase{
   void SetGoalPose(const Pose2Df& goal_pose);
   // define step function for human object
   void Step(const double& dt);
-  // transform lines from template lines based on pose_
-  void Transform();
 
   // check if human reaches the current goal
   bool CheckReachGoal();
   // set the maximum speed for human
   void SetSpeed(const double& max_speed, const double& avg_speed, const double& max_omega = 0.4, const double& avg_omega = 0.2);
-  void SetPose(const Pose2Df& pose);
   void SetVel(const Eigen::Vector2f& trans_vel, const double& rot_vel);
   void SetMode(const HumanMode& mode);
   double GetMaxSpeed();
@@ -0,0 +1,240 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    line_grid.cpp
+\brief   Uniform grid spatial index over a set of line segments.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "line_grid.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using std::max;
+using std::min;
+using std::vector;
+
+namespace {
+// Layout of a serialized LineGrid: this header, followed by the cell_start_,
+// cell_lines_ and line_cells_ arrays.
+struct GridHeader {
+  float cell_size;
+  float origin_x;
+  float origin_y;
+  int32_t width;
+  int32_t height;
+  int32_t num_indices;
+  int32_t num_lines;
+  int32_t padding;
+};
+}  // namespace
+
+namespace vector_map {
+
+LineGrid::LineGrid() :
+    cell_size_(1),
+    origin_(0, 0),
+    width_(0),
+    height_(0) {}
+
+void LineGrid::Clear() {
+  width_ = 0;
+  height_ = 0;
+  cell_start_.clear();
+  cell_lines_.clear();
+  line_cells_.clear();
+}
+
+int LineGrid::CellX(float x) const {
+  const int cx = static_cast<int>(floor((x - origin_.x()) / cell_size_));
+  return max(0, min(width_ - 1, cx));
+}
+
+int LineGrid::CellY(float y) const {
+  const int cy = static_cast<int>(floor((y - origin_.y()) / cell_size_));
+  return max(0, min(height_ - 1, cy));
+}
+
+void LineGrid::Build(const vector<Line2f>& lines, float cell_size) {
+  // Default cell size, and the largest number of cells to allocate before
+  // falling back to coarser cells.
+  static const float kDefaultCellSize = 2.0;
+  static const int kMaxCells = 1 << 22;
+  Clear();
+  if (lines.empty()) return;
+
+  Vector2f bmin = lines[0].p0;
+  Vector2f bmax = lines[0].p0;
+  for (const Line2f& l : lines) {
+    bmin = bmin.cwiseMin(l.p0).cwiseMin(l.p1);
+    bmax = bmax.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  cell_size_ = (cell_size > 0) ? cell_size : kDefaultCellSize;
+  const Vector2f extent = bmax - bmin;
+  while ((extent.x() / cell_size_ + 1.0) * (extent.y() / cell_size_ + 1.0) >
+         kMaxCells) {
+    cell_size_ *= 2.0;
+  }
+  origin_ = bmin;
+  width_ = static_cast<int>(floor(extent.x() / cell_size_)) + 1;
+  height_ = static_cast<int>(floor(extent.y() / cell_size_)) + 1;
+
+  // Two passes: count the lines per cell, then fill in the indices.
+  line_cells_.resize(lines.size());
+  cell_start_.assign(width_ * height_ + 1, 0);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const Line2f& l = lines[i];
+    CellRange& r = line_cells_[i];
+    r.x0 = CellX(min(l.p0.x(), l.p1.x()));
+    r.x1 = CellX(max(l.p0.x(), l.p1.x()));
+    r.y0 = CellY(min(l.p0.y(), l.p1.y()));
+    r.y1 = CellY(max(l.p0.y(), l.p1.y()));
+    for (int y = r.y0; y <= r.y1; ++y) {
+      for (int x = r.x0; x <= r.x1; ++x) {
+        ++cell_start_[y * width_ + x + 1];
+      }
+    }
+  }
+  for (size_t c = 1; c < cell_start_.size(); ++c) {
+    cell_start_[c] += cell_start_[c - 1];
+  }
+  cell_lines_.resize(cell_start_.back());
+  vector<int> fill(cell_start_.begin(), cell_start_.end() - 1);
+  for (size_t i = 0; i < lines.size(); ++i) {
+    const CellRange& r = line_cells_[i];
+    for (int y = r.y0; y <= r.y1; ++y) {
+      for (int x = r.x0; x <= r.x1; ++x) {
+        cell_lines_[fill[y * width_ + x]++] = i;
+      }
+    }
+  }
+}
+
+void LineGrid::QueryBox(const Vector2f& box_min,
+                        const Vector2f& box_max,
+                        vector<int>* indices) const {
+  if (width_ == 0 || height_ == 0) return;
+  if (box_max.x() < origin_.x() || box_max.y() < origin_.y() ||
+      box_min.x() > origin_.x() + cell_size_ * width_ ||
+      box_min.y() > origin_.y() + cell_size_ * height_) {
+    return;
+  }
+  const int x0 = CellX(box_min.x());
+  const int x1 = CellX(box_max.x());
+  const int y0 = CellY(box_min.y());
+  const int y1 = CellY(box_max.y());
+  for (int y = y0; y <= y1; ++y) {
+    for (int x = x0; x <= x1; ++x) {
+      const int c = y * width_ + x;
+      for (int j = cell_start_[c]; j < cell_start_[c + 1]; ++j) {
+        const int i = cell_lines_[j];
+        const CellRange& r = line_cells_[i];
+        // A line spanning several cells is only reported from the first
+        // cell it shares with the query, so no bookkeeping is needed to
+        // de-duplicate results.
+        if (x != max(r.x0, x0) || y != max(r.y0, y0)) continue;
+        indices->push_back(i);
+      }
+    }
+  }
+}
+
+size_t LineGrid::SerializedSize() const {
+  return sizeof(GridHeader) +
+      sizeof(int) * (cell_start_.size() + cell_lines_.size()) +
+      sizeof(CellRange) * line_cells_.size();
+}
+
+void LineGrid::Serialize(char* buffer) const {
+  GridHeader header;
+  memset(&header, 0, sizeof(header));
+  header.cell_size = cell_size_;
+  header.origin_x = origin_.x();
+  header.origin_y = origin_.y();
+  header.width = width_;
+  header.height = height_;
+  header.num_indices = cell_lines_.size();
+  header.num_lines = line_cells_.size();
+  memcpy(buffer, &header, sizeof(header));
+  buffer += sizeof(header);
+  memcpy(buffer, cell_start_.data(), sizeof(int) * cell_start_.size());
+  buffer += sizeof(int) * cell_start_.size();
+  memcpy(buffer, cell_lines_.data(), sizeof(int) * cell_lines_.size());
+  buffer += sizeof(int) * cell_lines_.size();
+  memcpy(buffer, line_cells_.data(), sizeof(CellRange) * line_cells_.size());
+}
+
+bool LineGrid::Deserialize(const char* buffer, size_t size) {
+  Clear();
+  GridHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, buffer, sizeof(header));
+  if (header.width < 0 || header.height < 0 ||
+      header.num_indices < 0 || header.num_lines < 0 ||
+      !(header.cell_size > 0)) {
+    return false;
+  }
+  const size_t num_cells =
+      static_cast<size_t>(header.width) * static_cast<size_t>(header.height);
+  if (num_cells == 0) {
+    // An index over no lines.
+    return (size == sizeof(header) &&
+            header.num_indices == 0 &&
+            header.num_lines == 0);
+  }
+  const size_t expected_size = sizeof(header) +
+      sizeof(int) * (num_cells + 1 + header.num_indices) +
+      sizeof(CellRange) * header.num_lines;
+  if (size != expected_size) return false;
+  buffer += sizeof(header);
+  cell_start_.resize(num_cells + 1);
+  memcpy(cell_start_.data(), buffer, sizeof(int) * cell_start_.size());
+  buffer += sizeof(int) * cell_start_.size();
+  cell_lines_.resize(header.num_indices);
+  memcpy(cell_lines_.data(), buffer, sizeof(int) * cell_lines_.size());
+  buffer += sizeof(int) * cell_lines_.size();
+  line_cells_.resize(header.num_lines);
+  memcpy(line_cells_.data(), buffer, sizeof(CellRange) * line_cells_.size());
+  // Check that queries will stay within the arrays.
+  bool valid = (cell_start_.front() == 0 &&
+                cell_start_.back() == header.num_indices);
+  for (size_t c = 0; valid && c < num_cells; ++c) {
+    valid = (cell_start_[c] <= cell_start_[c + 1]);
+  }
+  for (size_t i = 0; valid && i < cell_lines_.size(); ++i) {
+    valid = (cell_lines_[i] >= 0 && cell_lines_[i] < header.num_lines);
+  }
+  if (!valid) {
+    Clear();
+    return false;
+  }
+  cell_size_ = header.cell_size;
+  origin_ = Vector2f(header.origin_x, header.origin_y);
+  width_ = header.width;
+  height_ = header.height;
+  return true;
+}
+
+}  // namespace vector_map
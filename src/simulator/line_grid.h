@@ -0,0 +1,97 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    line_grid.h
+\brief   Uniform grid spatial index over a set of line segments.
+*/
+//========================================================================
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#ifndef SRC_SIMULATOR_LINE_GRID_H_
+#define SRC_SIMULATOR_LINE_GRID_H_
+
+namespace vector_map {
+
+// Uniform grid over a static set of line segments. Every cell stores the
+// indices of the lines whose bounding boxes overlap it, in compressed form
+// (one offsets array and one flat indices array), so that a query only
+// touches the lines near the query region rather than the whole set.
+// Queries are const and allocation-free apart from growing the output
+// vector, so a built grid may be shared across threads.
+class LineGrid {
+ public:
+  LineGrid();
+
+  // Rebuild the index over lines. If cell_size is not positive, a cell size
+  // is picked based on the extent of the lines.
+  void Build(const std::vector<geometry::Line2f>& lines, float cell_size);
+
+  void Clear();
+
+  // Number of lines the index was built over.
+  size_t NumLines() const { return line_cells_.size(); }
+
+  float CellSize() const { return cell_size_; }
+
+  // Append to indices the index of every line whose bounding box overlaps the
+  // axis-aligned box [box_min, box_max]. Each index is reported exactly once.
+  void QueryBox(const Eigen::Vector2f& box_min,
+                const Eigen::Vector2f& box_max,
+                std::vector<int>* indices) const;
+
+  // Size in bytes of the serialized index.
+  size_t SerializedSize() const;
+
+  // Write the index to buffer, which must hold SerializedSize() bytes.
+  void Serialize(char* buffer) const;
+
+  // Read an index written by Serialize from the size bytes at buffer, which
+  // need not be aligned. Returns false, leaving the index empty, if the data
+  // is not a valid index.
+  bool Deserialize(const char* buffer, size_t size);
+
+ private:
+  // Inclusive range of cells covered by the bounding box of a line.
+  struct CellRange {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+  };
+
+  int CellX(float x) const;
+  int CellY(float y) const;
+
+  float cell_size_;
+  Eigen::Vector2f origin_;
+  int width_;
+  int height_;
+  // The lines in cell c are cell_lines_[i] for
+  // cell_start_[c] <= i < cell_start_[c + 1].
+  std::vector<int> cell_start_;
+  std::vector<int> cell_lines_;
+  // Cells covered by each line, used to de-duplicate query results.
+  std::vector<CellRange> line_cells_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_LINE_GRID_H_
@@ -0,0 +1,183 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_cache.cpp
+\brief   Binary cache of preprocessed vector maps.
+*/
+//========================================================================
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "map_cache.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using std::string;
+using std::vector;
+
+namespace {
+// Identifies the cache file format, and its version. The version must be
+// incremented whenever the format, or the preprocessing of the lines,
+// changes.
+const uint32_t kCacheMagic = 0x50414d56;  // "VMAP"
+const uint32_t kCacheVersion = 1;
+
+// Layout of the cache file: this header, followed by the x0, y0, x1 and y1
+// coordinates of the lines as float arrays, followed by the serialized
+// LineGrid at grid_offset.
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t source_hash;
+  uint64_t num_lines;
+  uint64_t grid_offset;
+  uint64_t grid_size;
+};
+
+// Offset of the grid, rounded up to keep it 8-byte aligned.
+uint64_t GridOffset(uint64_t num_lines) {
+  const uint64_t end = sizeof(CacheHeader) + 4 * sizeof(float) * num_lines;
+  return (end + 7) / 8 * 8;
+}
+}  // namespace
+
+namespace vector_map {
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash) {
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool HashFile(const string& file, uint64_t* hash) {
+  FILE* fid = fopen(file.c_str(), "rb");
+  if (fid == NULL) return false;
+  *hash = kHashSeed;
+  char buffer[1 << 16];
+  size_t n = 0;
+  while ((n = fread(buffer, 1, sizeof(buffer), fid)) > 0) {
+    *hash = HashBytes(buffer, n, *hash);
+  }
+  const bool ok = (ferror(fid) == 0);
+  fclose(fid);
+  return ok;
+}
+
+string MapSideFileName(const string& map_file, const string& suffix) {
+  static const string kMapSuffix = ".vectormap.txt";
+  if (map_file.length() > kMapSuffix.length() &&
+      map_file.compare(map_file.length() - kMapSuffix.length(),
+                       kMapSuffix.length(),
+                       kMapSuffix) == 0) {
+    return map_file.substr(0, map_file.length() - kMapSuffix.length()) +
+        suffix;
+  }
+  return map_file + suffix;
+}
+
+bool SaveMapCache(const string& file,
+                  uint64_t source_hash,
+                  const vector<Line2f>& lines,
+                  const LineGrid& grid) {
+  const size_t n = lines.size();
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kCacheMagic;
+  header.version = kCacheVersion;
+  header.source_hash = source_hash;
+  header.num_lines = n;
+  header.grid_offset = GridOffset(n);
+  header.grid_size = grid.SerializedSize();
+
+  vector<char> data(header.grid_offset + header.grid_size, 0);
+  memcpy(data.data(), &header, sizeof(header));
+  float* coords = reinterpret_cast<float*>(data.data() + sizeof(header));
+  for (size_t i = 0; i < n; ++i) {
+    coords[i] = lines[i].p0.x();
+    coords[n + i] = lines[i].p0.y();
+    coords[2 * n + i] = lines[i].p1.x();
+    coords[3 * n + i] = lines[i].p1.y();
+  }
+  grid.Serialize(data.data() + header.grid_offset);
+
+  const string tmp_file = file + ".tmp" + std::to_string(getpid());
+  FILE* fid = fopen(tmp_file.c_str(), "wb");
+  if (fid == NULL) return false;
+  bool ok = (fwrite(data.data(), 1, data.size(), fid) == data.size());
+  ok = (fclose(fid) == 0) && ok;
+  ok = ok && (rename(tmp_file.c_str(), file.c_str()) == 0);
+  if (!ok) remove(tmp_file.c_str());
+  return ok;
+}
+
+bool LoadMapCache(const string& file,
+                  uint64_t source_hash,
+                  vector<Line2f>* lines,
+                  LineGrid* grid) {
+  const int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(CacheHeader)) {
+    close(fd);
+    return false;
+  }
+  const size_t size = st.st_size;
+  void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return false;
+  const char* data = static_cast<const char*>(mapped);
+
+  CacheHeader header;
+  memcpy(&header, data, sizeof(header));
+  bool ok = (header.magic == kCacheMagic &&
+             header.version == kCacheVersion &&
+             header.source_hash == source_hash &&
+             header.num_lines <= size / (4 * sizeof(float)) &&
+             header.grid_offset == GridOffset(header.num_lines) &&
+             header.grid_offset + header.grid_size == size);
+  ok = ok && grid->Deserialize(data + header.grid_offset, header.grid_size) &&
+      grid->NumLines() == header.num_lines;
+  if (ok) {
+    const size_t n = header.num_lines;
+    const float* coords =
+        reinterpret_cast<const float*>(data + sizeof(header));
+    lines->resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      (*lines)[i] = Line2f(Vector2f(coords[i], coords[n + i]),
+                           Vector2f(coords[2 * n + i], coords[3 * n + i]));
+    }
+  } else {
+    grid->Clear();
+  }
+  munmap(mapped, size);
+  return ok;
+}
+
+}  // namespace vector_map
@@ -0,0 +1,72 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_cache.h
+\brief   Binary cache of preprocessed vector maps.
+*/
+//========================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "math/line2d.h"
+
+#include "line_grid.h"
+
+#ifndef SRC_SIMULATOR_MAP_CACHE_H_
+#define SRC_SIMULATOR_MAP_CACHE_H_
+
+namespace vector_map {
+
+// Offset basis of the 64-bit FNV-1a hash.
+const uint64_t kHashSeed = 14695981039346656037ULL;
+
+// Continue a 64-bit FNV-1a hash over size bytes at data.
+uint64_t HashBytes(const void* data, size_t size, uint64_t hash);
+
+// Hash the contents of file. Returns false if the file cannot be read.
+bool HashFile(const std::string& file, uint64_t* hash);
+
+// Name of the file next to map_file with the ".vectormap.txt" suffix
+// replaced by suffix.
+std::string MapSideFileName(const std::string& map_file,
+                            const std::string& suffix);
+
+// The binary map cache holds the lines of a map after Cleanup, in
+// structure-of-arrays layout, and their spatial index, along with the hash of
+// the text map they were computed from. Loading it memory-maps the file, and
+// skips parsing the text and cleaning up the lines.
+
+// Save the cache to file. The file is written under a temporary name and
+// renamed, so that concurrent simulator instances never read a partial
+// cache. Returns true on success.
+bool SaveMapCache(const std::string& file,
+                  uint64_t source_hash,
+                  const std::vector<geometry::Line2f>& lines,
+                  const LineGrid& grid);
+
+// Load the cache from file. Returns false if the file does not exist, is
+// invalid, or was computed from a text map with a different hash.
+bool LoadMapCache(const std::string& file,
+                  uint64_t source_hash,
+                  std::vector<geometry::Line2f>* lines,
+                  LineGrid* grid);
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_MAP_CACHE_H_
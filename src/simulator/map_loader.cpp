@@ -0,0 +1,97 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_loader.cpp
+\brief   Loads vector maps on a background thread.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "map_loader.h"
+#include "vector_map.h"
+
+using std::string;
+using std::unique_ptr;
+
+namespace vector_map {
+
+MapLoader::MapLoader(float visibility_cell_size,
+                     float max_range,
+                     bool persist) :
+    visibility_cell_size_(visibility_cell_size),
+    max_range_(max_range),
+    persist_(persist),
+    stop_(false),
+    generation_(0) {}
+
+MapLoader::~MapLoader() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  condition_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void MapLoader::Start() {
+  thread_ = std::thread(&MapLoader::Run, this);
+}
+
+void MapLoader::Request(const string& file) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    requested_file_ = file;
+  }
+  condition_.notify_all();
+}
+
+unique_ptr<VectorMap> MapLoader::Take(uint64_t* generation) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  *generation = generation_;
+  return std::move(loaded_);
+}
+
+void MapLoader::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    condition_.wait(lock, [this]() {
+      return stop_ || !requested_file_.empty();
+    });
+    if (stop_) break;
+    string file;
+    file.swap(requested_file_);
+
+    // Load without holding the lock, so that requests are not blocked.
+    lock.unlock();
+    unique_ptr<VectorMap> map(new VectorMap());
+    const bool ok = map->Load(file, persist_);
+    if (ok && visibility_cell_size_ > 0.0) {
+      map->BuildVisibilityCache(visibility_cell_size_, max_range_);
+    }
+    lock.lock();
+    if (ok) {
+      loaded_ = std::move(map);
+      ++generation_;
+    }
+  }
+}
+
+}  // namespace vector_map
@@ -0,0 +1,85 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    map_loader.h
+\brief   Loads vector maps on a background thread.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "vector_map.h"
+
+#ifndef SRC_SIMULATOR_MAP_LOADER_H_
+#define SRC_SIMULATOR_MAP_LOADER_H_
+
+namespace vector_map {
+
+// Loads and preprocesses vector maps on a background thread, so that the
+// simulation keeps running at its rate while a new map is loaded. Maps are
+// loaded on request. Every loaded map increments the generation, so the
+// simulation only needs to compare generations to find out that a new map is
+// ready.
+class MapLoader {
+ public:
+  // The visibility cache of loaded maps is built for the given cell size and
+  // sensor range, if cell size is positive. If persist is set, maps are
+  // loaded with their binary cache, as in VectorMap::Load.
+  MapLoader(float visibility_cell_size, float max_range, bool persist);
+  ~MapLoader();
+  MapLoader(const MapLoader&) = delete;
+  MapLoader& operator=(const MapLoader&) = delete;
+
+  // Start the loader thread.
+  void Start();
+
+  // Request loading file, replacing any request not yet started.
+  void Request(const std::string& file);
+
+  // Generation of the most recently loaded map.
+  uint64_t Generation() const { return generation_; }
+
+  // Take the most recently loaded map, if it has not been taken yet, and set
+  // generation to its generation. Returns nullptr otherwise.
+  std::unique_ptr<VectorMap> Take(uint64_t* generation);
+
+ private:
+  void Run();
+
+  const float visibility_cell_size_;
+  const float max_range_;
+  const bool persist_;
+
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  // The following are protected by mutex_.
+  bool stop_;
+  std::string requested_file_;
+  std::unique_ptr<VectorMap> loaded_;
+
+  std::atomic<uint64_t> generation_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_MAP_LOADER_H_
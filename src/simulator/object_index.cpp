@@ -0,0 +1,267 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    object_index.cpp
+\brief   Dynamic bounding volume tree over the lines of moving objects.
+*/
+//========================================================================
+
+#include <algorithm>
+#include <memory>
+
+#include "eigen3/Eigen/Dense"
+
+#include "object_index.h"
+
+using Eigen::Vector2f;
+using pose_2d::Pose2Df;
+using std::max;
+
+namespace {
+// Margin by which the boxes of objects are enlarged, so that objects moving
+// less than this only need to be moved in the tree every few steps.
+const float kBoxMargin = 0.25;
+
+// Perimeter of the union of two boxes, the cost of a node in the tree.
+float UnionPerimeter(const Vector2f& min0, const Vector2f& max0,
+                     const Vector2f& min1, const Vector2f& max1) {
+  const Vector2f size = max0.cwiseMax(max1) - min0.cwiseMin(min1);
+  return 2.0 * (size.x() + size.y());
+}
+
+float Perimeter(const Vector2f& box_min, const Vector2f& box_max) {
+  const Vector2f size = box_max - box_min;
+  return 2.0 * (size.x() + size.y());
+}
+}  // namespace
+
+namespace vector_map {
+
+ObjectIndex::ObjectIndex() : root_(-1) {}
+
+void ObjectIndex::Clear() {
+  nodes_.clear();
+  free_nodes_.clear();
+  root_ = -1;
+  objects_.clear();
+}
+
+void ObjectIndex::Update(int id,
+                         const std::shared_ptr<const Shape>& shape,
+                         const Pose2Df& pose) {
+  if (id >= NumIds()) {
+    Object empty;
+    empty.leaf = -1;
+    objects_.resize(id + 1, empty);
+  }
+  Object& object = objects_[id];
+  if (object.leaf >= 0 && object.shape == shape &&
+      object.pose.angle == pose.angle &&
+      object.pose.translation == pose.translation) {
+    return;
+  }
+  if (!shape || (shape->Lines().empty() && shape->Circles().empty())) {
+    Remove(id);
+    return;
+  }
+  if (object.shape != shape) object.shape = shape;
+  object.pose = pose;
+  object.bounds = Circle(pose.translation, shape->Radius());
+  // The shape is within its radius of the pose at any angle, so the box only
+  // depends on the translation.
+  const Vector2f radius(shape->Radius(), shape->Radius());
+  const Vector2f box_min = pose.translation - radius;
+  const Vector2f box_max = pose.translation + radius;
+  int leaf = object.leaf;
+  if (leaf >= 0) {
+    const Node& n = nodes_[leaf];
+    if (n.box_min.x() <= box_min.x() && n.box_min.y() <= box_min.y() &&
+        n.box_max.x() >= box_max.x() && n.box_max.y() >= box_max.y()) {
+      return;
+    }
+    RemoveLeaf(leaf);
+  } else {
+    leaf = AllocateNode();
+    object.leaf = leaf;
+  }
+  Node& n = nodes_[leaf];
+  n.box_min = box_min - Vector2f(kBoxMargin, kBoxMargin);
+  n.box_max = box_max + Vector2f(kBoxMargin, kBoxMargin);
+  n.id = id;
+  InsertLeaf(leaf);
+}
+
+void ObjectIndex::Remove(int id) {
+  if (id < 0 || id >= NumIds()) return;
+  Object& object = objects_[id];
+  object.shape.reset();
+  object.bounds = Circle();
+  if (object.leaf < 0) return;
+  RemoveLeaf(object.leaf);
+  FreeNode(object.leaf);
+  object.leaf = -1;
+}
+
+int ObjectIndex::AllocateNode() {
+  Node n;
+  n.box_min = Vector2f(0, 0);
+  n.box_max = Vector2f(0, 0);
+  n.parent = -1;
+  n.child1 = -1;
+  n.child2 = -1;
+  n.height = 0;
+  n.id = -1;
+  if (free_nodes_.empty()) {
+    nodes_.push_back(n);
+    return static_cast<int>(nodes_.size()) - 1;
+  }
+  const int i = free_nodes_.back();
+  free_nodes_.pop_back();
+  nodes_[i] = n;
+  return i;
+}
+
+void ObjectIndex::FreeNode(int i) {
+  free_nodes_.push_back(i);
+}
+
+void ObjectIndex::Refit(int i) {
+  Node& n = nodes_[i];
+  const Node& c1 = nodes_[n.child1];
+  const Node& c2 = nodes_[n.child2];
+  n.box_min = c1.box_min.cwiseMin(c2.box_min);
+  n.box_max = c1.box_max.cwiseMax(c2.box_max);
+  n.height = 1 + max(c1.height, c2.height);
+}
+
+void ObjectIndex::InsertLeaf(int leaf) {
+  if (root_ < 0) {
+    root_ = leaf;
+    nodes_[leaf].parent = -1;
+    return;
+  }
+  const Vector2f box_min = nodes_[leaf].box_min;
+  const Vector2f box_max = nodes_[leaf].box_max;
+  // Descend to the sibling for which the total perimeter of the tree grows
+  // the least.
+  int sibling = root_;
+  while (nodes_[sibling].child1 >= 0) {
+    const Node& n = nodes_[sibling];
+    const float perimeter = Perimeter(n.box_min, n.box_max);
+    const float combined =
+        UnionPerimeter(n.box_min, n.box_max, box_min, box_max);
+    // Cost of making the leaf a sibling of this node.
+    const float cost = 2.0 * combined;
+    // Cost of descending, which grows every ancestor below this node.
+    const float inheritance = 2.0 * (combined - perimeter);
+    float child_cost[2];
+    for (int k = 0; k < 2; ++k) {
+      const Node& c = nodes_[k == 0 ? n.child1 : n.child2];
+      const float c_combined =
+          UnionPerimeter(c.box_min, c.box_max, box_min, box_max);
+      child_cost[k] = inheritance + ((c.child1 < 0) ?
+          c_combined : c_combined - Perimeter(c.box_min, c.box_max));
+    }
+    if (cost < child_cost[0] && cost < child_cost[1]) break;
+    sibling = (child_cost[0] < child_cost[1]) ? n.child1 : n.child2;
+  }
+
+  const int old_parent = nodes_[sibling].parent;
+  const int new_parent = AllocateNode();
+  nodes_[new_parent].parent = old_parent;
+  nodes_[new_parent].child1 = sibling;
+  nodes_[new_parent].child2 = leaf;
+  nodes_[sibling].parent = new_parent;
+  nodes_[leaf].parent = new_parent;
+  if (old_parent < 0) {
+    root_ = new_parent;
+  } else if (nodes_[old_parent].child1 == sibling) {
+    nodes_[old_parent].child1 = new_parent;
+  } else {
+    nodes_[old_parent].child2 = new_parent;
+  }
+
+  for (int i = new_parent; i >= 0; i = nodes_[i].parent) {
+    i = Balance(i);
+    Refit(i);
+  }
+}
+
+void ObjectIndex::RemoveLeaf(int leaf) {
+  if (leaf == root_) {
+    root_ = -1;
+    return;
+  }
+  const int parent = nodes_[leaf].parent;
+  const int grandparent = nodes_[parent].parent;
+  const int sibling = (nodes_[parent].child1 == leaf) ?
+      nodes_[parent].child2 : nodes_[parent].child1;
+  nodes_[leaf].parent = -1;
+  FreeNode(parent);
+  nodes_[sibling].parent = grandparent;
+  if (grandparent < 0) {
+    root_ = sibling;
+    return;
+  }
+  if (nodes_[grandparent].child1 == parent) {
+    nodes_[grandparent].child1 = sibling;
+  } else {
+    nodes_[grandparent].child2 = sibling;
+  }
+  for (int i = grandparent; i >= 0; i = nodes_[i].parent) {
+    i = Balance(i);
+    Refit(i);
+  }
+}
+
+int ObjectIndex::Balance(int a) {
+  if (nodes_[a].child1 < 0 || nodes_[a].height < 2) return a;
+  const int b = nodes_[a].child1;
+  const int c = nodes_[a].child2;
+  const int balance = nodes_[c].height - nodes_[b].height;
+  if (balance >= -1 && balance <= 1) return a;
+
+  // Rotate the taller child, up, into the place of a. The taller of its
+  // children stays with it, and the other one takes its place under a.
+  const int up = (balance > 1) ? c : b;
+  const int f = nodes_[up].child1;
+  const int g = nodes_[up].child2;
+  const int parent = nodes_[a].parent;
+  nodes_[up].parent = parent;
+  nodes_[a].parent = up;
+  if (parent < 0) {
+    root_ = up;
+  } else if (nodes_[parent].child1 == a) {
+    nodes_[parent].child1 = up;
+  } else {
+    nodes_[parent].child2 = up;
+  }
+  const bool keep_f = nodes_[f].height > nodes_[g].height;
+  const int kept = keep_f ? f : g;
+  const int moved = keep_f ? g : f;
+  nodes_[up].child1 = a;
+  nodes_[up].child2 = kept;
+  if (up == c) {
+    nodes_[a].child2 = moved;
+  } else {
+    nodes_[a].child1 = moved;
+  }
+  nodes_[moved].parent = a;
+  Refit(a);
+  Refit(up);
+  return up;
+}
+
+}  // namespace vector_map
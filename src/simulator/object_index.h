@@ -0,0 +1,137 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    object_index.h
+\brief   Dynamic bounding volume tree over the lines of moving objects.
+*/
+//========================================================================
+
+#include <memory>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/poses_2d.h"
+
+#include "shape.h"
+
+#ifndef SRC_SIMULATOR_OBJECT_INDEX_H_
+#define SRC_SIMULATOR_OBJECT_INDEX_H_
+
+namespace vector_map {
+
+// Bounding volume tree over the shapes of moving objects, made of lines and
+// circles, keyed by object id. Objects keep a shared shape and a pose, and
+// their lines and circles are only moved to the pose when they are read.
+// Each object is a leaf with a box enlarged by a margin, and is only moved in
+// the tree when its shape leaves that box, so objects that stand still or
+// move a little cost nothing to update. The tree is kept balanced by
+// rotations, like an AVL tree.
+class ObjectIndex {
+ public:
+  ObjectIndex();
+
+  // Remove all objects.
+  void Clear();
+
+  // Set the shape of object id, in its own frame, and its pose, adding the
+  // object if it is new. Ids should be small, since storage is allocated for
+  // every id up to the largest.
+  void Update(int id,
+              const std::shared_ptr<const Shape>& shape,
+              const pose_2d::Pose2Df& pose);
+
+  // Remove object id, if present.
+  void Remove(int id);
+
+  // One more than the largest id that was ever updated.
+  int NumIds() const { return static_cast<int>(objects_.size()); }
+
+  // Lines and circles of object id at its pose, empty if it is not present.
+  ShapeView View(int id) const {
+    return ShapeView(objects_[id].shape.get(), objects_[id].pose);
+  }
+
+  // Circle that contains the shape of object id at any angle, so that whole
+  // objects out of range of a query are rejected before their lines and
+  // circles are transformed.
+  const Circle& Bounds(int id) const { return objects_[id].bounds; }
+
+  // Call visit(id) for every object whose enlarged box overlaps the query
+  // box. Only reads the tree, so queries may run concurrently.
+  template <typename Visitor>
+  void Query(const Eigen::Vector2f& box_min,
+             const Eigen::Vector2f& box_max,
+             const Visitor& visit) const {
+    if (root_ >= 0) QueryNode(root_, box_min, box_max, visit);
+  }
+
+ private:
+  struct Node {
+    Eigen::Vector2f box_min;
+    Eigen::Vector2f box_max;
+    int parent;
+    // Children of inner nodes, or -1 for leaves.
+    int child1;
+    int child2;
+    // Height of the subtree, 0 for leaves.
+    int height;
+    // Object of leaves.
+    int id;
+  };
+
+  struct Object {
+    std::shared_ptr<const Shape> shape;
+    pose_2d::Pose2Df pose;
+    Circle bounds;
+    // Leaf of the object, or -1 if it is not in the tree.
+    int leaf;
+  };
+
+  template <typename Visitor>
+  void QueryNode(int i,
+                 const Eigen::Vector2f& box_min,
+                 const Eigen::Vector2f& box_max,
+                 const Visitor& visit) const {
+    const Node& n = nodes_[i];
+    if (n.box_min.x() > box_max.x() || n.box_min.y() > box_max.y() ||
+        n.box_max.x() < box_min.x() || n.box_max.y() < box_min.y()) {
+      return;
+    }
+    if (n.child1 < 0) {
+      visit(n.id);
+      return;
+    }
+    QueryNode(n.child1, box_min, box_max, visit);
+    QueryNode(n.child2, box_min, box_max, visit);
+  }
+
+  int AllocateNode();
+  void FreeNode(int i);
+  void InsertLeaf(int leaf);
+  void RemoveLeaf(int leaf);
+  // Recompute the box and height of inner node i from its children.
+  void Refit(int i);
+  // Rotate the subtree at i if it is unbalanced, and return its new root.
+  int Balance(int i);
+
+  std::vector<Node> nodes_;
+  std::vector<int> free_nodes_;
+  int root_;
+  std::vector<Object> objects_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_OBJECT_INDEX_H_
@@ -1,6 +1,5 @@
 #include "simulator/omnidirectional_model.h"
 #include <eigen3/Eigen/src/Geometry/Rotation2D.h>
-#include "shared/util/timer.h"
 #include "shared/math/math_util.h"
 #include "ut_multirobot_sim/CobotOdometryMsg.h"
 
@@ -36,7 +35,10 @@ OmnidirectionalModel::OmnidirectionalModel(
     last_cmd_(),
     t_last_cmd_(0),
     angular_error_(0, 1),
-    config_reader_(config_files){
+    config_reader_(config_files),
+    odom_delta_(0, {0, 0}),
+    step_start_(0, {0, 0}),
+    step_odom_delta_(0, {0, 0}) {
   // Use the config reader to initialize the subscriber
   drive_subscriber_ = n->subscribe(
       CONFIG_drive_topic,
@@ -54,7 +56,23 @@ void OmnidirectionalModel::DriveCallback(const CobotDriveMsg& msg) {
         msg.velocity_x, msg.velocity_y, msg.velocity_r);
   }
   last_cmd_ = msg;
-  t_last_cmd_ = GetMonotonicTime();
+  t_last_cmd_ = sim_time_;
+  ++command_count_;
+}
+
+void OmnidirectionalModel::AccumulateOdom() {
+  const Vector2f step = Rotation2Df(-step_start_.angle) *
+      (pose_.translation - step_start_.translation);
+  odom_delta_.translation = step_odom_delta_.translation +
+      Rotation2Df(step_odom_delta_.angle) * step;
+  odom_delta_.angle = step_odom_delta_.angle +
+      AngleDiff(pose_.angle, step_start_.angle);
+}
+
+void OmnidirectionalModel::Stop() {
+  RobotModel::Stop();
+  // The collision response has moved the robot back along the last step.
+  AccumulateOdom();
 }
 
 void OmnidirectionalModel::PublishOdom(const float dt) {
@@ -63,9 +81,12 @@ void OmnidirectionalModel::PublishOdom(const float dt) {
   const Vector2f w2 = Heading(CONFIG_w2);
   const Vector2f w3 = Heading(CONFIG_w3);
   CobotOdometryMsg msg;
-  msg.dr = vel_.angle * dt;
-  msg.dx = vel_.translation.x() * dt;
-  msg.dy = vel_.translation.y() * dt;
+  // Report the motion of the robot since the last message, which, unlike
+  // the current velocity times dt, accounts for acceleration within the
+  // period and for collisions.
+  msg.dr = odom_delta_.angle;
+  msg.dx = odom_delta_.translation.x();
+  msg.dy = odom_delta_.translation.y();
   msg.v0 = vel_.translation.dot(w0)+CONFIG_base_r*vel_.angle;
   msg.v1 = vel_.translation.dot(w1)+CONFIG_base_r*vel_.angle;
   msg.v2 = vel_.translation.dot(w2)+CONFIG_base_r*vel_.angle;
@@ -76,14 +97,17 @@ void OmnidirectionalModel::PublishOdom(const float dt) {
   msg.VBatt = 32.0;
   msg.status = 0x04;
   odom_publisher_.publish(msg);
+  odom_delta_ = Pose2Df(0, {0, 0});
+  step_start_ = pose_;
+  step_odom_delta_ = odom_delta_;
 }
 
 //TODO(jaholtz) Add noise
 void OmnidirectionalModel::Step(const double &dt) {
-  // TODO(jaholtz) For faster than real time simulation we may need
-  // a wallclock invariant method for this.
   static const double kMaxCommandAge = 0.1;
-  if (GetMonotonicTime() > t_last_cmd_ + kMaxCommandAge) {
+  step_start_ = pose_;
+  step_odom_delta_ = odom_delta_;
+  if (sim_time_ > t_last_cmd_ + kMaxCommandAge) {
     last_cmd_.velocity_x = 0;
     last_cmd_.velocity_y = 0;
     last_cmd_.velocity_r = 0;
@@ -119,7 +143,7 @@ void OmnidirectionalModel::Step(const double &dt) {
 
   pose_.translation += Rotation2Df(pose_.angle) * vel_.translation * dt;
   pose_.angle = AngleMod(pose_.angle + vel_.angle * dt);
-  PublishOdom(dt);
+  AccumulateOdom();
 }
 
 } // namespace omnidrive
@@ -20,9 +20,19 @@ class OmnidirectionalModel : public robot_model::RobotModel {
   ros::Subscriber drive_subscriber_;
   config_reader::ConfigReader config_reader_;
   ros::Publisher odom_publisher_;
+  // Motion since the odometry was last published, in the frame of the robot
+  // at that time.
+  pose_2d::Pose2Df odom_delta_;
+  // Pose at the start of the last step, and odom_delta_ before it, so that
+  // the step is accounted again when the collision response moves the robot.
+  pose_2d::Pose2Df step_start_;
+  pose_2d::Pose2Df step_odom_delta_;
 
   // Receives drive callback messages and stores them
   void DriveCallback(const ut_multirobot_sim::CobotDriveMsg& msg);
+  // Sets odom_delta_ to step_odom_delta_ plus the motion from step_start_
+  // to the current pose.
+  void AccumulateOdom();
 
  public:
   OmnidirectionalModel() = delete;
@@ -32,6 +42,7 @@ class OmnidirectionalModel : public robot_model::RobotModel {
   ~OmnidirectionalModel() = default;
   // define Step function for updating
   void Step(const double& dt);
+  void Stop();
   void PublishOdom(const float dt);
 };
 
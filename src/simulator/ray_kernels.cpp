@@ -0,0 +1,195 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    ray_kernels.cpp
+\brief   SIMD kernels for intersecting packets of rays with line segments.
+*/
+//========================================================================
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "ray_kernels.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+
+// For a ray from the origin with direction d, and a segment p0 + s * e,
+// the ray parameter t and segment parameter s of the intersection are:
+//   t = Cross(p0, e) / Cross(d, e)
+//   s = Cross(p0, d) / Cross(d, e)
+// and the ray hits the segment iff t >= 0 and 0 <= s <= 1. Parallel lines
+// produce infinite or NaN values for s, which fail the comparisons.
+
+namespace vector_map {
+
+void LineSoA::Clear() {
+  x0.clear();
+  y0.clear();
+  dx.clear();
+  dy.clear();
+}
+
+void LineSoA::Add(const Line2f& line, const Vector2f& origin) {
+  x0.push_back(line.p0.x() - origin.x());
+  y0.push_back(line.p0.y() - origin.y());
+  dx.push_back(line.p1.x() - line.p0.x());
+  dy.push_back(line.p1.y() - line.p0.y());
+}
+
+#if defined(__AVX512F__)
+
+int RayPacketSize() { return 16; }
+
+void IntersectRayPacket(const LineSoA& lines,
+                        const int* indices,
+                        int num_indices,
+                        const float* ray_x,
+                        const float* ray_y,
+                        float* ranges) {
+  const __m512 zero = _mm512_set1_ps(0.0f);
+  const __m512 one = _mm512_set1_ps(1.0f);
+  const __m512 rx = _mm512_loadu_ps(ray_x);
+  const __m512 ry = _mm512_loadu_ps(ray_y);
+  __m512 range = _mm512_loadu_ps(ranges);
+  for (int k = 0; k < num_indices; ++k) {
+    const int j = indices[k];
+    const __m512 x0 = _mm512_set1_ps(lines.x0[j]);
+    const __m512 y0 = _mm512_set1_ps(lines.y0[j]);
+    const __m512 ex = _mm512_set1_ps(lines.dx[j]);
+    const __m512 ey = _mm512_set1_ps(lines.dy[j]);
+    const __m512 tn = _mm512_set1_ps(
+        lines.x0[j] * lines.dy[j] - lines.y0[j] * lines.dx[j]);
+    const __m512 den = _mm512_sub_ps(_mm512_mul_ps(rx, ey),
+                                     _mm512_mul_ps(ry, ex));
+    const __m512 sn = _mm512_sub_ps(_mm512_mul_ps(x0, ry),
+                                    _mm512_mul_ps(y0, rx));
+    const __m512 t = _mm512_div_ps(tn, den);
+    const __m512 s = _mm512_div_ps(sn, den);
+    __mmask16 hit = _mm512_cmp_ps_mask(t, zero, _CMP_GE_OQ);
+    hit &= _mm512_cmp_ps_mask(s, zero, _CMP_GE_OQ);
+    hit &= _mm512_cmp_ps_mask(s, one, _CMP_LE_OQ);
+    hit &= _mm512_cmp_ps_mask(t, range, _CMP_LT_OQ);
+    range = _mm512_mask_mov_ps(range, hit, t);
+  }
+  _mm512_storeu_ps(ranges, range);
+}
+
+#elif defined(__AVX__)
+
+int RayPacketSize() { return 8; }
+
+void IntersectRayPacket(const LineSoA& lines,
+                        const int* indices,
+                        int num_indices,
+                        const float* ray_x,
+                        const float* ray_y,
+                        float* ranges) {
+  const __m256 zero = _mm256_set1_ps(0.0f);
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 rx = _mm256_loadu_ps(ray_x);
+  const __m256 ry = _mm256_loadu_ps(ray_y);
+  __m256 range = _mm256_loadu_ps(ranges);
+  for (int k = 0; k < num_indices; ++k) {
+    const int j = indices[k];
+    const __m256 x0 = _mm256_set1_ps(lines.x0[j]);
+    const __m256 y0 = _mm256_set1_ps(lines.y0[j]);
+    const __m256 ex = _mm256_set1_ps(lines.dx[j]);
+    const __m256 ey = _mm256_set1_ps(lines.dy[j]);
+    const __m256 tn = _mm256_set1_ps(
+        lines.x0[j] * lines.dy[j] - lines.y0[j] * lines.dx[j]);
+    const __m256 den = _mm256_sub_ps(_mm256_mul_ps(rx, ey),
+                                     _mm256_mul_ps(ry, ex));
+    const __m256 sn = _mm256_sub_ps(_mm256_mul_ps(x0, ry),
+                                    _mm256_mul_ps(y0, rx));
+    const __m256 t = _mm256_div_ps(tn, den);
+    const __m256 s = _mm256_div_ps(sn, den);
+    const __m256 hit = _mm256_and_ps(
+        _mm256_and_ps(_mm256_cmp_ps(t, zero, _CMP_GE_OQ),
+                      _mm256_cmp_ps(t, range, _CMP_LT_OQ)),
+        _mm256_and_ps(_mm256_cmp_ps(s, zero, _CMP_GE_OQ),
+                      _mm256_cmp_ps(s, one, _CMP_LE_OQ)));
+    range = _mm256_blendv_ps(range, t, hit);
+  }
+  _mm256_storeu_ps(ranges, range);
+}
+
+#elif defined(__SSE2__)
+
+int RayPacketSize() { return 4; }
+
+void IntersectRayPacket(const LineSoA& lines,
+                        const int* indices,
+                        int num_indices,
+                        const float* ray_x,
+                        const float* ray_y,
+                        float* ranges) {
+  const __m128 zero = _mm_set1_ps(0.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 rx = _mm_loadu_ps(ray_x);
+  const __m128 ry = _mm_loadu_ps(ray_y);
+  __m128 range = _mm_loadu_ps(ranges);
+  for (int k = 0; k < num_indices; ++k) {
+    const int j = indices[k];
+    const __m128 x0 = _mm_set1_ps(lines.x0[j]);
+    const __m128 y0 = _mm_set1_ps(lines.y0[j]);
+    const __m128 ex = _mm_set1_ps(lines.dx[j]);
+    const __m128 ey = _mm_set1_ps(lines.dy[j]);
+    const __m128 tn =
+        _mm_set1_ps(lines.x0[j] * lines.dy[j] - lines.y0[j] * lines.dx[j]);
+    const __m128 den = _mm_sub_ps(_mm_mul_ps(rx, ey), _mm_mul_ps(ry, ex));
+    const __m128 sn = _mm_sub_ps(_mm_mul_ps(x0, ry), _mm_mul_ps(y0, rx));
+    const __m128 t = _mm_div_ps(tn, den);
+    const __m128 s = _mm_div_ps(sn, den);
+    const __m128 hit = _mm_and_ps(
+        _mm_and_ps(_mm_cmpge_ps(t, zero), _mm_cmplt_ps(t, range)),
+        _mm_and_ps(_mm_cmpge_ps(s, zero), _mm_cmple_ps(s, one)));
+    range = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, range));
+  }
+  _mm_storeu_ps(ranges, range);
+}
+
+#else
+
+int RayPacketSize() { return 1; }
+
+void IntersectRayPacket(const LineSoA& lines,
+                        const int* indices,
+                        int num_indices,
+                        const float* ray_x,
+                        const float* ray_y,
+                        float* ranges) {
+  for (int k = 0; k < num_indices; ++k) {
+    const int j = indices[k];
+    const float den = ray_x[0] * lines.dy[j] - ray_y[0] * lines.dx[j];
+    const float t =
+        (lines.x0[j] * lines.dy[j] - lines.y0[j] * lines.dx[j]) / den;
+    const float s = (lines.x0[j] * ray_y[0] - lines.y0[j] * ray_x[0]) / den;
+    if (t >= 0.0f && t < ranges[0] && s >= 0.0f && s <= 1.0f) {
+      ranges[0] = t;
+    }
+  }
+}
+
+#endif
+
+}  // namespace vector_map
@@ -0,0 +1,61 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    ray_kernels.h
+\brief   SIMD kernels for intersecting packets of rays with line segments.
+*/
+//========================================================================
+
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#ifndef SRC_SIMULATOR_RAY_KERNELS_H_
+#define SRC_SIMULATOR_RAY_KERNELS_H_
+
+namespace vector_map {
+
+// Line segments in structure-of-arrays layout, relative to a ray origin:
+// segment i runs from (x0[i], y0[i]) to (x0[i] + dx[i], y0[i] + dy[i]).
+struct LineSoA {
+  std::vector<float> x0;
+  std::vector<float> y0;
+  std::vector<float> dx;
+  std::vector<float> dy;
+
+  void Clear();
+  // Add a line, translated so that origin is at (0, 0).
+  void Add(const geometry::Line2f& line, const Eigen::Vector2f& origin);
+  size_t Size() const { return x0.size(); }
+};
+
+// Number of rays processed together by IntersectRayPacket: 16 with AVX-512,
+// 8 with AVX, 4 with SSE, and 1 otherwise.
+int RayPacketSize();
+
+// For each of the RayPacketSize() rays from the origin with unit direction
+// (ray_x[i], ray_y[i]), lower ranges[i] to the distance to the nearest
+// intersection with any of the lines listed in indices, if closer.
+void IntersectRayPacket(const LineSoA& lines,
+                        const int* indices,
+                        int num_indices,
+                        const float* ray_x,
+                        const float* ray_y,
+                        float* ranges);
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_RAY_KERNELS_H_
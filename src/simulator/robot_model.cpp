@@ -26,7 +26,9 @@ namespace robot_model {
 
 RobotModel::RobotModel() :
     EntityBase(),
-    vel_(0,{0,0}) {}
+    vel_(0,{0,0}),
+    sim_time_(0),
+    command_count_(0) {}
 
 void RobotModel::SetVel(const pose_2d::Pose2Df& vel) {
  vel_ = vel;
@@ -36,4 +38,12 @@ Pose2Df RobotModel::GetVel() {
   return vel_;
 }
 
+void RobotModel::Stop() {
+  vel_ = Pose2Df(0, {0, 0});
+}
+
+void RobotModel::SetSimTime(double t) {
+  sim_time_ = t;
+}
+
 }
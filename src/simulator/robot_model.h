@@ -20,6 +20,8 @@
 */
 //========================================================================
 
+#include <stdint.h>
+
 #include "simulator/entity_base.h"
 
 #ifndef SRC_SIMULATOR_ROBOT_MODEL_H_
@@ -29,12 +31,28 @@ namespace robot_model {
 class RobotModel : public EntityBase {
  protected:
   Pose2Df vel_;
+  // Simulator time of the current step, which commands are stamped and aged
+  // with, so that stepping faster or slower than the wall clock does not
+  // change when commands time out.
+  double sim_time_;
+  // Number of drive commands received so far.
+  uint64_t command_count_;
 
  public:
   RobotModel();
   virtual ~RobotModel() = default;
   virtual void SetVel(const pose_2d::Pose2Df& vel);
   virtual pose_2d::Pose2Df GetVel();
+  // Stops the robot, such as after a step that collided, clearing any
+  // velocities the model keeps besides vel_.
+  virtual void Stop();
+  // Publishes the model's own odometry, if it has any, for the dt seconds
+  // since it was last published. Called at the odometry period, after
+  // collisions are resolved, so that it reports the resolved pose.
+  virtual void PublishOdom(const float dt) {}
+  // Sets the simulator time, in seconds, of the next step.
+  virtual void SetSimTime(double t);
+  uint64_t GetCommandCount() const { return command_count_; }
 };
 }  // namespace robot_model
 
@@ -0,0 +1,223 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_check.cpp
+\brief   Checks the predicted scans of every backend against brute force
+         ray intersection, on a scene where objects cross walls and each
+         other.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "gflags/gflags.h"
+
+#include "shared/math/geometry.h"
+#include "shared/math/line2d.h"
+#include "simulator/shape.h"
+#include "simulator/vector_map.h"
+
+using Eigen::Vector2f;
+using geometry::Cross;
+using geometry::Line2f;
+using pose_2d::Pose2Df;
+using std::vector;
+using vector_map::Circle;
+using vector_map::ScanGeometry;
+using vector_map::ShapeView;
+using vector_map::VectorMap;
+
+DEFINE_string(map, "", "Vector map to scan in, or empty for a grid of rooms.");
+DEFINE_int32(scans, 500, "Number of random scans to check.");
+DEFINE_int32(objects, 200, "Number of boxes and circles placed at random.");
+DEFINE_double(range, 10.0, "Maximum range of the scanner.");
+DEFINE_double(tolerance, 1e-3, "Largest range error counted as a match.");
+DEFINE_double(max_mismatch, 1e-4, "Largest fraction of mismatched rays.");
+DEFINE_int32(seed, 1, "Seed for the objects and the scan poses.");
+
+// Walls of a grid of square rooms of side 4, with a door in every wall.
+vector<Line2f> RoomLines(int rooms) {
+  static const float kSide = 4;
+  static const float kDoor = 1;
+  vector<Line2f> lines;
+  for (int i = 0; i <= rooms; ++i) {
+    for (int j = 0; j < rooms; ++j) {
+      const float a = j * kSide;
+      const float b = a + 0.5 * (kSide - kDoor);
+      const float c = b + kDoor;
+      const float d = a + kSide;
+      const float x = i * kSide;
+      lines.push_back(Line2f(Vector2f(x, a), Vector2f(x, b)));
+      lines.push_back(Line2f(Vector2f(x, c), Vector2f(x, d)));
+      lines.push_back(Line2f(Vector2f(a, x), Vector2f(b, x)));
+      lines.push_back(Line2f(Vector2f(c, x), Vector2f(d, x)));
+    }
+  }
+  return lines;
+}
+
+// Range along the ray from loc with unit direction dir to line l, or a
+// negative value if the ray misses it.
+float Intersect(const Vector2f& loc, const Vector2f& dir, const Line2f& l) {
+  const Vector2f p0 = l.p0 - loc;
+  const Vector2f e = l.p1 - l.p0;
+  const float denom = Cross(dir, e);
+  if (denom == 0.0) return -1;
+  const float t = Cross(p0, e) / denom;
+  const float u = Cross(p0, dir) / denom;
+  return (t > 0.0 && u >= 0.0 && u <= 1.0) ? t : -1;
+}
+
+// Scan from loc by intersecting every ray with every line and circle of the
+// map, leaving out object ignore_object.
+void BruteForceScan(const VectorMap& map,
+                    const Vector2f& loc,
+                    float range_max,
+                    float angle,
+                    const ScanGeometry& geometry,
+                    int num_objects,
+                    int ignore_object,
+                    vector<float>* scan) {
+  vector<Line2f> lines = map.lines;
+  vector<Circle> circles;
+  for (int id = 0; id < num_objects; ++id) {
+    if (id == ignore_object) continue;
+    const ShapeView view = map.object_index.View(id);
+    for (int k = 0; k < view.NumLines(); ++k) lines.push_back(view.Line(k));
+    for (int k = 0; k < view.NumCircles(); ++k) {
+      circles.push_back(view.GetCircle(k));
+    }
+  }
+  vector<Vector2f> rays;
+  geometry.Rotate(angle, &rays);
+  scan->assign(rays.size(), range_max);
+  for (size_t i = 0; i < rays.size(); ++i) {
+    float& r = (*scan)[i];
+    for (const Line2f& l : lines) {
+      const float t = Intersect(loc, rays[i], l);
+      if (t > 0.0 && t < r) r = t;
+    }
+    for (const Circle& c : circles) {
+      const float t = c.Intersect(loc, rays[i]);
+      if (t > 0.0 && t < r) r = t;
+    }
+  }
+}
+
+// Number of rays of scan that differ from expected. Hits beyond range_max
+// are reported by some backends and not by others, so ranges are compared
+// up to range_max.
+int CountMismatches(const float* scan,
+                    const vector<float>& expected,
+                    float range_max) {
+  int n = 0;
+  for (size_t i = 0; i < expected.size(); ++i) {
+    const float error = std::min(scan[i], range_max) -
+                        std::min(expected[i], range_max);
+    if (fabs(error) > FLAGS_tolerance) ++n;
+  }
+  return n;
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  VectorMap map(FLAGS_map.empty() ? RoomLines(8) : vector<Line2f>());
+  if (!FLAGS_map.empty() && !map.Load(FLAGS_map, false)) return 1;
+  if (map.lines.empty()) {
+    fprintf(stderr, "ERROR: Map %s has no lines\n", FLAGS_map.c_str());
+    return 1;
+  }
+  Vector2f box_min = map.lines[0].p0;
+  Vector2f box_max = map.lines[0].p0;
+  for (const Line2f& l : map.lines) {
+    box_min = box_min.cwiseMin(l.p0).cwiseMin(l.p1);
+    box_max = box_max.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  std::mt19937 rng(FLAGS_seed);
+  std::uniform_real_distribution<float> x(box_min.x(), box_max.x());
+  std::uniform_real_distribution<float> y(box_min.y(), box_max.y());
+  std::uniform_real_distribution<float> heading(-M_PI, M_PI);
+  std::uniform_real_distribution<float> size(0.2, 1.5);
+
+  // Boxes are placed anywhere, so many of them cross walls and each other.
+  for (int id = 0; id < FLAGS_objects; ++id) {
+    const Pose2Df pose(heading(rng), Vector2f(x(rng), y(rng)));
+    if (id % 3 == 0) {
+      map.object_index.Update(id, vector_map::CircleShape(0.2), pose);
+    } else {
+      map.object_index.Update(
+          id,
+          vector_map::BoxShape(size(rng), size(rng), Vector2f(0, 0)),
+          pose);
+    }
+  }
+
+  const float range_max = FLAGS_range;
+  const ScanGeometry geometries[] = {
+    ScanGeometry(-0.75 * M_PI, 0.75 * M_PI, 1080),
+    ScanGeometry(-M_PI, M_PI, 720),
+    ScanGeometry(-0.25 * M_PI, 0.25 * M_PI, 361),
+  };
+  int total_rays = 0;
+  int scalar_mismatches = 0;
+  int simd_mismatches = 0;
+  int batch_mismatches = 0;
+  vector_map::ScanWorkspace workspace;
+  vector_map::BatchScanWorkspace batch_workspace;
+  vector<float> expected, scan, batch;
+  for (const ScanGeometry& geometry : geometries) {
+    vector<Vector2f> locs;
+    vector<float> angles;
+    for (int k = 0; k < FLAGS_scans; ++k) {
+      locs.push_back(Vector2f(x(rng), y(rng)));
+      angles.push_back(heading(rng));
+    }
+    // Every scan leaves out one of the objects, like the robot carrying the
+    // sensor, and the batch leaves out the same one.
+    const int ignore_object = 1;
+    map.GetPredictedScans(locs, angles, range_max, geometry, ignore_object,
+                          &batch_workspace, &batch);
+    for (int k = 0; k < FLAGS_scans; ++k) {
+      BruteForceScan(map, locs[k], range_max, angles[k], geometry,
+                     FLAGS_objects, ignore_object, &expected);
+      map.GetPredictedScan(locs[k], range_max, angles[k], geometry,
+                           ignore_object, &workspace, &scan);
+      scalar_mismatches += CountMismatches(scan.data(), expected, range_max);
+      map.GetPredictedScanSimd(locs[k], range_max, angles[k], geometry,
+                               ignore_object, &workspace, &scan);
+      simd_mismatches += CountMismatches(scan.data(), expected, range_max);
+      batch_mismatches += CountMismatches(
+          batch.data() + k * geometry.NumRays(), expected, range_max);
+      total_rays += geometry.NumRays();
+    }
+  }
+  printf("%d rays, mismatches: scalar %d, simd %d, batch %d\n",
+         total_rays, scalar_mismatches, simd_mismatches, batch_mismatches);
+  const int max_mismatches = FLAGS_max_mismatch * total_rays;
+  if (scalar_mismatches > max_mismatches ||
+      simd_mismatches > max_mismatches ||
+      batch_mismatches > max_mismatches) {
+    fprintf(stderr, "ERROR: More than %d mismatched rays\n", max_mismatches);
+    return 1;
+  }
+  return 0;
+}
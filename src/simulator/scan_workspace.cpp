@@ -0,0 +1,133 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_workspace.cpp
+\brief   Reusable scratch buffers for simulating laser scans.
+*/
+//========================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+#include "scan_workspace.h"
+
+namespace vector_map {
+
+NodePool::NodePool() :
+    node_size_(0),
+    free_(nullptr) {}
+
+NodePool::~NodePool() {
+  for (char* chunk : chunks_) {
+    delete[] chunk;
+  }
+}
+
+void* NodePool::Allocate(size_t size) {
+  // Number of nodes allocated together.
+  static const size_t kNodesPerChunk = 256;
+  if (node_size_ == 0) {
+    // Round up so that every node in a chunk is suitably aligned.
+    const size_t align = alignof(std::max_align_t);
+    node_size_ = std::max(size, sizeof(FreeNode));
+    node_size_ = (node_size_ + align - 1) / align * align;
+  }
+  if (size > node_size_) return ::operator new(size);
+  if (free_ == nullptr) {
+    char* chunk = new char[kNodesPerChunk * node_size_];
+    chunks_.push_back(chunk);
+    for (size_t i = 0; i < kNodesPerChunk; ++i) {
+      FreeNode* node = reinterpret_cast<FreeNode*>(chunk + i * node_size_);
+      node->next = free_;
+      free_ = node;
+    }
+  }
+  FreeNode* node = free_;
+  free_ = node->next;
+  return node;
+}
+
+void NodePool::Free(void* p, size_t size) {
+  if (size > node_size_) {
+    ::operator delete(p);
+    return;
+  }
+  FreeNode* node = static_cast<FreeNode*>(p);
+  node->next = free_;
+  free_ = node;
+}
+
+ScanWorkspace::ScanWorkspace() : num_chunks_(0) {
+  std::fill(capacity_, capacity_ + kNumBuffers, 0);
+}
+
+int64_t ScanWorkspace::CountAllocations() {
+  const size_t capacity[] = {
+    candidates.capacity(),
+    scene_lines.capacity(),
+    object_lines.capacity(),
+    scene_circles.capacity(),
+    visible.capacity(),
+    rays.capacity(),
+    sweep.segments.capacity(),
+    sweep.events.capacity(),
+    sweep.position.capacity(),
+    line_cast.capacity(),
+    soa.x0.capacity(),
+    soa.y0.capacity(),
+    soa.dx.capacity(),
+    soa.dy.capacity(),
+    ray_x.capacity(),
+    ray_y.capacity(),
+    ranges.capacity(),
+    intervals.capacity(),
+    packet_start.capacity() + packet_lines.capacity() +
+        packet_fill.capacity(),
+  };
+  static_assert(sizeof(capacity) / sizeof(capacity[0]) == kNumBuffers,
+                "Every buffer must be counted");
+  int64_t n = sweep.active_nodes.NumChunks() - num_chunks_;
+  num_chunks_ = sweep.active_nodes.NumChunks();
+  for (int i = 0; i < kNumBuffers; ++i) {
+    if (capacity[i] != capacity_[i]) ++n;
+    capacity_[i] = capacity[i];
+  }
+  return n;
+}
+
+AllocationCounter::AllocationCounter(const char* name) :
+    name_(name),
+    total_allocations_(0),
+    total_invocations_(0) {}
+
+AllocationCounter::~AllocationCounter() {
+  printf("Allocation stats for %s : allocations = %lld, invocations = %lld\n",
+         name_,
+         static_cast<long long>(total_allocations_.load()),
+         static_cast<long long>(total_invocations_.load()));
+}
+
+AllocationCounter::Invocation::~Invocation() {
+  counter_->total_allocations_ += workspace_->CountAllocations();
+  ++counter_->total_invocations_;
+}
+
+}  // namespace vector_map
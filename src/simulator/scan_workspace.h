@@ -0,0 +1,229 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    scan_workspace.h
+\brief   Reusable scratch buffers for simulating laser scans.
+*/
+//========================================================================
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#include "circle.h"
+#include "ray_kernels.h"
+
+#ifndef SRC_SIMULATOR_SCAN_WORKSPACE_H_
+#define SRC_SIMULATOR_SCAN_WORKSPACE_H_
+
+namespace vector_map {
+
+// Free list of fixed-size nodes, allocated in chunks and kept for reuse after
+// they are freed. Requests of any other size go to the heap.
+class NodePool {
+ public:
+  NodePool();
+  ~NodePool();
+  NodePool(const NodePool&) = delete;
+  NodePool& operator=(const NodePool&) = delete;
+
+  void* Allocate(size_t size);
+  void Free(void* p, size_t size);
+
+  // Number of chunks allocated from the heap so far.
+  int64_t NumChunks() const { return static_cast<int64_t>(chunks_.size()); }
+
+ private:
+  struct FreeNode {
+    FreeNode* next;
+  };
+  size_t node_size_;
+  FreeNode* free_;
+  std::vector<char*> chunks_;
+};
+
+// Allocator for node-based containers that takes its nodes from a NodePool.
+template <typename T>
+struct PoolAllocator {
+  typedef T value_type;
+
+  explicit PoolAllocator(NodePool* pool) : pool(pool) {}
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(pool->Allocate(n * sizeof(T)));
+  }
+  void deallocate(T* p, size_t n) { pool->Free(p, n * sizeof(T)); }
+
+  NodePool* pool;
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>& a, const PoolAllocator<U>& b) {
+  return a.pool == b.pool;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>& a, const PoolAllocator<U>& b) {
+  return a.pool != b.pool;
+}
+
+// A line segment seen from the sweep origin, with endpoints relative to the
+// origin in counter-clockwise order, and their angles in [-pi, pi].
+struct SweepSegment {
+  Eigen::Vector2f p0;
+  Eigen::Vector2f p1;
+  float a0;
+  float a1;
+  int id;
+};
+
+struct SweepEvent {
+  float angle;
+  bool start;
+  int segment;
+  bool operator<(const SweepEvent& other) const {
+    if (angle != other.angle) return angle < other.angle;
+    // Close segments before opening new ones at the same angle.
+    return (!start && other.start);
+  }
+};
+
+// Orders the active segments by their range along the current sweep ray.
+// Segments that do not cross each other keep the same relative order for as
+// long as they are both active, so the order only needs to be evaluated at
+// insertion.
+struct SweepOrder {
+  const std::vector<SweepSegment>* segments;
+  const Eigen::Vector2f* dir;
+  bool operator()(int i, int j) const;
+};
+
+typedef std::set<int, SweepOrder, PoolAllocator<int> > SweepActiveSet;
+
+// Scratch buffers for VisibleSegments.
+struct SweepWorkspace {
+  std::vector<SweepSegment> segments;
+  std::vector<SweepEvent> events;
+  std::vector<SweepActiveSet::iterator> position;
+  NodePool active_nodes;
+};
+
+// A visible segment relative to the sensor, with its endpoints in
+// counter-clockwise order.
+struct LineCast {
+  Eigen::Vector2f p0;
+  Eigen::Vector2f p1;
+  Eigen::Vector2f dir;
+  float cross_p0_dir;
+};
+
+// The packets of rays in [p0, p1] may hit line.
+struct RayInterval {
+  int line;
+  int p0;
+  int p1;
+};
+
+// Scratch buffers for simulating scans. Scans only clear and refill these
+// buffers, so a workspace that is kept for each sensor, or each thread, stops
+// allocating memory once its buffers have grown to the size of the scenes
+// that are seen.
+struct ScanWorkspace {
+  ScanWorkspace();
+
+  // Number of buffers that grew since the last call, which is a lower bound
+  // on the number of heap allocations made in between.
+  int64_t CountAllocations();
+
+  std::vector<int> candidates;
+  std::vector<geometry::Line2f> scene_lines;
+  std::vector<geometry::Line2f> object_lines;
+  std::vector<Circle> scene_circles;
+  std::vector<geometry::Line2f> visible;
+  std::vector<Eigen::Vector2f> rays;
+  SweepWorkspace sweep;
+  std::vector<LineCast> line_cast;
+
+  // Used by the SIMD backend.
+  LineSoA soa;
+  std::vector<float> ray_x;
+  std::vector<float> ray_y;
+  std::vector<float> ranges;
+  std::vector<RayInterval> intervals;
+  std::vector<int> packet_start;
+  std::vector<int> packet_lines;
+  std::vector<int> packet_fill;
+
+ private:
+  static const int kNumBuffers = 19;
+  size_t capacity_[kNumBuffers];
+  int64_t num_chunks_;
+};
+
+// Scratch buffers for simulating batches of scans: the poses sorted into
+// groups of nearby poses, and the buffers of each thread.
+struct BatchScanWorkspace {
+  struct Thread {
+    // Map lines and object ids in range of any pose of the group being
+    // simulated.
+    std::vector<geometry::Line2f> group_lines;
+    std::vector<int> group_objects;
+    ScanWorkspace scan;
+  };
+
+  // Grouping grid cell and index of each pose, sorted by cell.
+  std::vector<std::pair<uint64_t, int> > order;
+  // Start of each group in order, followed by the number of poses.
+  std::vector<int> group_start;
+  std::vector<std::unique_ptr<Thread> > threads;
+};
+
+// Counts the heap allocations made by the scan workspaces passed to a
+// function, and reports the totals on exit, like CumulativeFunctionTimer
+// does for run times. Safe to share between threads.
+class AllocationCounter {
+ public:
+  class Invocation {
+   public:
+    Invocation(AllocationCounter* counter, ScanWorkspace* workspace) :
+        counter_(counter), workspace_(workspace) {}
+    ~Invocation();
+
+   private:
+    AllocationCounter* const counter_;
+    ScanWorkspace* const workspace_;
+  };
+
+  explicit AllocationCounter(const char* name);
+  ~AllocationCounter();
+
+  const char* name_;
+  std::atomic<int64_t> total_allocations_;
+  std::atomic<int64_t> total_invocations_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_SCAN_WORKSPACE_H_
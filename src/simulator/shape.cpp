@@ -0,0 +1,95 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    shape.cpp
+\brief   Shared shapes of entities, and views of them at a pose.
+*/
+//========================================================================
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "shape.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using std::max;
+using std::shared_ptr;
+using std::vector;
+
+namespace {
+// Shapes made so far, by their arguments. Shapes are small and there are
+// few kinds of entities, so they are kept for the life of the process.
+std::mutex shapes_mutex;
+std::map<float, shared_ptr<const vector_map::Shape> > circle_shapes;
+std::map<std::tuple<float, float, float, float>,
+         shared_ptr<const vector_map::Shape> > box_shapes;
+}  // namespace
+
+namespace vector_map {
+
+Shape::Shape(const vector<Line2f>& lines, const vector<Circle>& circles) :
+    lines_(lines), circles_(circles), radius_(0) {
+  for (const Line2f& l : lines_) {
+    radius_ = max(radius_, max(l.p0.norm(), l.p1.norm()));
+  }
+  for (const Circle& c : circles_) {
+    radius_ = max(radius_, c.center.norm() + c.radius);
+  }
+}
+
+shared_ptr<const Shape> CircleShape(float radius) {
+  std::lock_guard<std::mutex> lock(shapes_mutex);
+  shared_ptr<const Shape>& shape = circle_shapes[radius];
+  if (!shape) {
+    shape = std::make_shared<const Shape>(
+        vector<Line2f>(), vector<Circle>(1, Circle(Vector2f(0, 0), radius)));
+  }
+  return shape;
+}
+
+shared_ptr<const Shape> BoxShape(float length,
+                                 float width,
+                                 const Vector2f& center) {
+  std::lock_guard<std::mutex> lock(shapes_mutex);
+  shared_ptr<const Shape>& shape =
+      box_shapes[std::make_tuple(length, width, center.x(), center.y())];
+  if (!shape) {
+    const Vector2f half_length(0.5 * length, 0);
+    const Vector2f half_width(0, 0.5 * width);
+    // Corners in counter-clockwise order.
+    const Vector2f corners[4] = {
+      center - half_length - half_width,
+      center + half_length - half_width,
+      center + half_length + half_width,
+      center - half_length + half_width,
+    };
+    vector<Line2f> lines;
+    for (int k = 0; k < 4; ++k) {
+      lines.push_back(Line2f(corners[k], corners[(k + 1) % 4]));
+    }
+    shape = std::make_shared<const Shape>(lines, vector<Circle>());
+  }
+  return shape;
+}
+
+}  // namespace vector_map
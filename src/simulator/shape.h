@@ -0,0 +1,110 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    shape.h
+\brief   Shared shapes of entities, and views of them at a pose.
+*/
+//========================================================================
+
+#include <math.h>
+
+#include <memory>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+#include "math/poses_2d.h"
+
+#include "circle.h"
+
+#ifndef SRC_SIMULATOR_SHAPE_H_
+#define SRC_SIMULATOR_SHAPE_H_
+
+namespace vector_map {
+
+// Lines and circles of an entity in its own frame. Shapes never change once
+// made, so all entities of the same kind share one shape, and only keep
+// their pose.
+class Shape {
+ public:
+  Shape(const std::vector<geometry::Line2f>& lines,
+        const std::vector<Circle>& circles);
+
+  const std::vector<geometry::Line2f>& Lines() const { return lines_; }
+  const std::vector<Circle>& Circles() const { return circles_; }
+
+  // Distance from the origin of the shape frame to its farthest point.
+  float Radius() const { return radius_; }
+
+ private:
+  const std::vector<geometry::Line2f> lines_;
+  const std::vector<Circle> circles_;
+  float radius_;
+};
+
+// Circle of the given radius around the origin. Calls with the same radius
+// return the same shape.
+std::shared_ptr<const Shape> CircleShape(float radius);
+
+// Rectangle of length along the x axis and width along the y axis, centered
+// at center. Calls with the same arguments return the same shape.
+std::shared_ptr<const Shape> BoxShape(float length,
+                                      float width,
+                                      const Eigen::Vector2f& center);
+
+// A shape at a pose, which transforms the lines and circles of the shape to
+// the world frame one at a time as they are read, instead of copying them.
+class ShapeView {
+ public:
+  ShapeView() : shape_(nullptr), cos_(1), sin_(0), translation_(0, 0) {}
+  ShapeView(const Shape* shape, const pose_2d::Pose2Df& pose) :
+      shape_(shape),
+      cos_(cos(pose.angle)),
+      sin_(sin(pose.angle)),
+      translation_(pose.translation) {}
+
+  int NumLines() const {
+    return shape_ ? static_cast<int>(shape_->Lines().size()) : 0;
+  }
+
+  int NumCircles() const {
+    return shape_ ? static_cast<int>(shape_->Circles().size()) : 0;
+  }
+
+  geometry::Line2f Line(int i) const {
+    const geometry::Line2f& l = shape_->Lines()[i];
+    return geometry::Line2f(Transform(l.p0), Transform(l.p1));
+  }
+
+  Circle GetCircle(int i) const {
+    const Circle& c = shape_->Circles()[i];
+    return Circle(Transform(c.center), c.radius);
+  }
+
+ private:
+  Eigen::Vector2f Transform(const Eigen::Vector2f& p) const {
+    return Eigen::Vector2f(cos_ * p.x() - sin_ * p.y() + translation_.x(),
+                           sin_ * p.x() + cos_ * p.y() + translation_.y());
+  }
+
+  const Shape* shape_;
+  float cos_;
+  float sin_;
+  Eigen::Vector2f translation_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_SHAPE_H_
@@ -28,12 +28,7 @@ ShortTermObject::ShortTermObject() {
 
   // Example of a simple shape
   const float r = 0.5;
-  const float eps = 0.001;
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(r - eps, r), Eigen::Vector2f(-r + eps, r)));
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(-r, r - eps), Eigen::Vector2f(-r, -r + eps)));
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(-r + eps, -r), Eigen::Vector2f(r - eps, -r)));
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(r, -r + eps), Eigen::Vector2f(r, r - eps)));
-  pose_lines_ = template_lines_;
+  shape_ = vector_map::BoxShape(2 * r, 2 * r, Eigen::Vector2f(0., 0.));
 }
 
 ShortTermObject::ShortTermObject(const std::string& config_file) {
@@ -50,20 +45,8 @@ ShortTermObject::ShortTermObject(const std::string& config_file) {
   }
 
   // TODO(yifeng): Load the shape from a config file, replace the example in the future
-  const double r = 0.5;
-  const double eps = 0.001;
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(r - eps, r), Eigen::Vector2f(-r + eps, r)));
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(-r, r - eps), Eigen::Vector2f(-r, -r + eps)));
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(-r + eps, -r), Eigen::Vector2f(r - eps, -r)));
-  template_lines_.push_back(geometry::Line2f(Eigen::Vector2f(r, -r + eps), Eigen::Vector2f(r, r - eps)));
-
-  Eigen::Rotation2Df R(math_util::AngleMod(pose_.angle));
-  Eigen::Vector2f T = pose_.translation;
-  pose_lines_.resize(template_lines_.size());
-  for (size_t i=0; i < template_lines_.size(); i++) {
-    pose_lines_[i].p0 = R * (template_lines_[i].p0) + T;
-    pose_lines_[i].p1 = R * (template_lines_[i].p1) + T;
-  }  
+  const float r = 0.5;
+  shape_ = vector_map::BoxShape(2 * r, 2 * r, Eigen::Vector2f(0., 0.));
 }
 
 
@@ -23,6 +23,7 @@
 #include <math.h>
 #include <memory>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <random>
 
@@ -45,6 +46,8 @@
 #include "vector_map.h"
 
 DEFINE_bool(localize, false, "Publish localization");
+DEFINE_string(lockstep_ignore, "", "Comma-separated indices of the robots "
+              "without controllers, which lockstep does not wait for.");
 
 using Eigen::Rotation2Df;
 using Eigen::Vector2f;
@@ -58,8 +61,14 @@ using ackermann::AckermannModel;
 using std::atan2;
 using omnidrive::OmnidirectionalModel;
 using diffdrive::DiffDriveModel;
+using vector_map::Circle;
 using vector_map::VectorMap;
 using human::HumanObject;
+using ut_multirobot_sim::SimulatorBatchScanSrv;
+using ut_multirobot_sim::SimulatorSetMapSrv;
+using vector_map::MapLoader;
+using collision::CollisionChecker;
+using collision::ParseCollisionResponse;
 
 CONFIG_STRING(init_config_file, "init_config_file");
 // Used for visualizations
@@ -73,11 +82,27 @@ CONFIG_FLOAT(laser_y, "laser_loc.y");
 CONFIG_FLOAT(laser_z, "laser_loc.z");
 // Timestep size
 CONFIG_FLOAT(DT, "delta_t");
+CONFIG_FLOAT(real_time_factor, "real_time_factor");
+// Periods of the sensors and publications
+CONFIG_FLOAT(laser_period, "laser_period");
+CONFIG_FLOAT(odometry_period, "odometry_period");
+CONFIG_FLOAT(tf_period, "tf_period");
+CONFIG_FLOAT(localization_period, "localization_period");
+CONFIG_FLOAT(visualization_period, "visualization_period");
+CONFIG_BOOL(human_crowd, "human_crowd");
+CONFIG_FLOAT(human_flow_field_cell_size, "human_flow_field_cell_size");
+CONFIG_FLOAT(human_flow_field_clearance, "human_flow_field_clearance");
+CONFIG_BOOL(human_flow_field_save, "human_flow_field_save");
+CONFIG_STRING(collision_response, "collision_response");
+CONFIG_FLOAT(collision_cell_size, "collision_cell_size");
 CONFIG_FLOAT(laser_stdev, "laser_noise_stddev");
+CONFIG_INT(laser_noise_seed, "laser_noise_seed");
 // TF publications
 CONFIG_BOOL(publish_tfs, "publish_tfs");
 CONFIG_BOOL(publish_map_to_odom, "publish_map_to_odom");
 CONFIG_BOOL(publish_foot_to_base, "publish_foot_to_base");
+// Simulator time publication
+CONFIG_BOOL(publish_clock, "publish_clock");
 
 // Used for topic names and robot specs
 CONFIG_STRINGLIST(robot_types, "robot_types");
@@ -91,8 +116,11 @@ CONFIG_FLOAT(laser_angle_max, "laser_angle_max");
 CONFIG_FLOAT(laser_angle_increment, "laser_angle_increment");
 CONFIG_FLOAT(laser_min_range, "laser_min_range");
 CONFIG_FLOAT(laser_max_range, "laser_max_range");
+CONFIG_STRING(laser_scan_backend, "laser_scan_backend");
 
 CONFIG_STRING(map_name, "map_name");
+CONFIG_FLOAT(map_visibility_cell_size, "map_visibility_cell_size");
+CONFIG_BOOL(map_cache_save, "map_cache_save");
 // Initial location
 CONFIG_VECTOR3FLIST(start_poses, "start_poses");
 CONFIG_STRINGLIST(short_term_object_config_list, "short_term_object_config_list");
@@ -104,7 +132,8 @@ config_reader::ConfigReader object_reader(object_config_list); */
 Simulator::Simulator(const std::string& sim_config) :
     reader_({sim_config}),
     init_config_reader_({CONFIG_init_config_file}),
-    laser_noise_(0, 1),
+    map_generation_(0),
+    collision_response_(collision::CollisionResponse::kNone),
     sim_step_count(0),
     sim_time(0.0) {
   truePoseMsg.header.seq = 0;
@@ -122,6 +151,20 @@ double Simulator::GetStepSize() const {
   return CONFIG_DT;
 }
 
+bool Simulator::CommandsReceived() const {
+  for (const auto& rps : robot_pub_subs_) {
+    if (rps.controlled && rps.observed &&
+        rps.motion_model->GetCommandCount() == rps.step_command_count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+double Simulator::GetRealTimeFactor() const {
+  return CONFIG_real_time_factor;
+}
+
 robot_model::RobotModel* MakeMotionModel(const std::string& robot_type, 
                                          ros::NodeHandle& n, 
                                          const std::string& topic_prefix) {
@@ -152,7 +195,9 @@ bool Simulator::init(ros::NodeHandle& n) {
   scanDataMsg.range_max = CONFIG_laser_max_range;
   scanDataMsg.intensities.clear();
   scanDataMsg.time_increment = 0.0;
-  scanDataMsg.scan_time = 0.05;
+  const int num_laser_rays = static_cast<int>(
+      1.0 + (scanDataMsg.angle_max - scanDataMsg.angle_min) /
+      scanDataMsg.angle_increment);
 
   odometryTwistMsg.header.seq = 0;
   odometryTwistMsg.header.frame_id = "odom";
@@ -165,9 +210,55 @@ bool Simulator::init(ros::NodeHandle& n) {
   }
 
 
+  // Load the initial map before the simulation starts. Later map changes
+  // are loaded in the background by map_loader_.
+  if (!map_.Load(CONFIG_map_name, CONFIG_map_cache_save)) {
+    return false;
+  }
+  if (CONFIG_map_visibility_cell_size > 0.0) {
+    map_.BuildVisibilityCache(CONFIG_map_visibility_cell_size,
+                              CONFIG_laser_max_range);
+  }
+  map_loader_.reset(new MapLoader(CONFIG_map_visibility_cell_size,
+                                  CONFIG_laser_max_range,
+                                  CONFIG_map_cache_save));
+  map_loader_->Start();
+  map_name_ = CONFIG_map_name;
+  if (CONFIG_human_flow_field_cell_size > 0.0) {
+    flow_fields_.reset(new vector_map::FlowFieldCache(
+        CONFIG_human_flow_field_cell_size, CONFIG_human_flow_field_clearance));
+    flow_fields_->Reset(map_, CONFIG_human_flow_field_save);
+  }
+
+  if (!ParseCollisionResponse(CONFIG_collision_response,
+                              &collision_response_)) {
+    fprintf(stderr, "ERROR: Unknown collision response \"%s\"\n",
+            CONFIG_collision_response.c_str());
+    return false;
+  }
+  if (CONFIG_real_time_factor < 0) {
+    fprintf(stderr, "ERROR: Negative real time factor %f\n",
+            CONFIG_real_time_factor);
+    return false;
+  }
+  // The robot body is centered behind the pose by the rear axle offset.
+  collision_checker_.reset(new CollisionChecker(CONFIG_collision_cell_size,
+                                                CONFIG_car_length,
+                                                CONFIG_car_width,
+                                                -CONFIG_rear_axle_offset));
+  robot_shape_ = vector_map::BoxShape(CONFIG_car_length,
+                                      CONFIG_car_width,
+                                      Vector2f(-CONFIG_rear_axle_offset, 0));
+
   initSimulatorVizMarkers();
   drawMap();
 
+  scheduler_.reset(new TaskScheduler(CONFIG_DT));
+  odometry_task_ = scheduler_->Add(CONFIG_odometry_period, 0);
+  tf_task_ = scheduler_->Add(CONFIG_tf_period, 0);
+  localization_task_ = scheduler_->Add(CONFIG_localization_period, 0);
+  visualization_task_ = scheduler_->Add(CONFIG_visualization_period, 0);
+
   // Create motion model based on robot type
   for (size_t i = 0; i < CONFIG_start_poses.size(); ++i) {
     const auto& robot_type = CONFIG_robot_types.at(i);
@@ -182,6 +273,24 @@ bool Simulator::init(ros::NodeHandle& n) {
     robot_pub_subs_.emplace_back(RobotPubSub());
     auto& rps = robot_pub_subs_.back();
     rps.motion_model = std::unique_ptr<robot_model::RobotModel>(mm);
+    rps.step_command_count = 0;
+    rps.observed = false;
+    rps.controlled = true;
+    rps.scanDataMsg = scanDataMsg;
+    rps.scanDataMsg.header.frame_id = pf + CONFIG_laser_frame;
+    // Stagger the lasers of the robots, to spread the scans over the steps.
+    rps.laser_task = scheduler_->Add(CONFIG_laser_period, i);
+    rps.scanDataMsg.scan_time = scheduler_->Period(rps.laser_task);
+    rps.laser_geometry.Set(scanDataMsg.angle_min,
+                           scanDataMsg.angle_max,
+                           num_laser_rays);
+    rps.scan_workspace.reset(new vector_map::ScanWorkspace());
+    // Seed each robot's noise stream from the robot index, so that the
+    // noise does not depend on the order in which scans are simulated.
+    std::seed_seq seed({static_cast<uint32_t>(CONFIG_laser_noise_seed),
+                        static_cast<uint32_t>(i)});
+    rps.laser_rng.seed(seed);
+    rps.laser_noise = std::normal_distribution<float>(0, 1);
 
     rps.initSubscriber = n.subscribe<ut_multirobot_sim::Localization2DMsg>(
        pf + "/initialpose", 1, [&](const boost::shared_ptr<const ut_multirobot_sim::Localization2DMsg>& msg) {
@@ -204,9 +313,29 @@ bool Simulator::init(ros::NodeHandle& n) {
         localizationMsg.header.seq = 0;
       }
   }
+  const char* ignore = FLAGS_lockstep_ignore.c_str();
+  while (*ignore != '\0') {
+    char* end = nullptr;
+    const long i = strtol(ignore, &end, 10);
+    if (end == ignore || i < 0 ||
+        i >= static_cast<long>(robot_pub_subs_.size())) {
+      fprintf(stderr, "ERROR: Invalid robots to ignore in lockstep '%s'\n",
+              FLAGS_lockstep_ignore.c_str());
+      return false;
+    }
+    robot_pub_subs_[i].controlled = false;
+    ignore = (*end == ',') ? end + 1 : end;
+  }
 
   mapLinesPublisher = n.advertise<visualization_msgs::Marker>("/simulator_visualization", 6);
   objectLinesPublisher = n.advertise<visualization_msgs::Marker>("/simulator_visualization", 6);
+  if (CONFIG_publish_clock) {
+    clockPublisher = n.advertise<rosgraph_msgs::Clock>("/clock", 1);
+  }
+  setMapService = n.advertiseService(
+      "sim_set_map", &Simulator::SetMapCallback, this);
+  batchScanService = n.advertiseService(
+      "sim_batch_scan", &Simulator::BatchScanCallback, this);
   
 
   br = new tf::TransformBroadcaster();
@@ -222,11 +351,19 @@ void Simulator::loadObject() {
     std::unique_ptr<ShortTermObject>(new ShortTermObject("short_term_config.lua")));
 
   // human
+  crowd_.Clear();
   for (const string& config_str: CONFIG_human_config_list) {
+    if (CONFIG_human_crowd) {
+      crowd_.Add(human::ReadHumanConfig({config_str}));
+      continue;
+    }
     objects.push_back(
       std::unique_ptr<HumanObject>(new HumanObject({config_str})));
 
   }
+  if (flow_fields_ != nullptr) {
+    crowd_.BuildFlowFields(map_, flow_fields_.get());
+  }
 }
 
 /**
@@ -344,13 +481,35 @@ void Simulator::drawMap() {
 void Simulator::drawObjects() {
   // draw objects
   ros_helpers::ClearMarker(&objectLinesMarker);
-  for (const Line2f& l : map_.object_lines) {
-    ros_helpers::DrawEigen2DLine(l.p0, l.p1, &objectLinesMarker);
+  // Robots are drawn with their own markers.
+  for (int id = robot_pub_subs_.size(); id < map_.object_index.NumIds(); ++id) {
+    const vector_map::ShapeView view = map_.object_index.View(id);
+    for (int k = 0; k < view.NumLines(); ++k) {
+      const Line2f l = view.Line(k);
+      ros_helpers::DrawEigen2DLine(l.p0, l.p1, &objectLinesMarker);
+    }
+    // Circles are drawn as polygons.
+    static const int kCircleSegments = 16;
+    for (int j = 0; j < view.NumCircles(); ++j) {
+      const Circle c = view.GetCircle(j);
+      for (int k = 0; k < kCircleSegments; ++k) {
+        const float a0 = 2.0 * M_PI * k / kCircleSegments;
+        const float a1 = 2.0 * M_PI * (k + 1) / kCircleSegments;
+        ros_helpers::DrawEigen2DLine(
+            c.center + c.radius * Vector2f(cos(a0), sin(a0)),
+            c.center + c.radius * Vector2f(cos(a1), sin(a1)),
+            &objectLinesMarker);
+      }
+    }
   }
 }
 
 void Simulator::publishOdometry() {
+  const float period = scheduler_->Period(odometry_task_);
   for (auto& rps : robot_pub_subs_) {
+    rps.observed = true;
+    // Models with their own odometry messages publish them too.
+    rps.motion_model->PublishOdom(period);
     tf::Quaternion robotQ = tf::createQuaternionFromYaw(rps.cur_loc.angle);
 
     odometryTwistMsg.header.stamp = ros::Time::now();
@@ -369,7 +528,15 @@ void Simulator::publishOdometry() {
     odometryTwistMsg.twist.twist.linear.z = 0.0;
 
     rps.odometryTwistPublisher.publish(odometryTwistMsg);
+  }
+}
 
+void Simulator::publishVisualizationMarkers() {
+  drawObjects();
+  mapLinesPublisher.publish(lineListMarker);
+  objectLinesPublisher.publish(objectLinesMarker);
+  for (auto& rps : robot_pub_subs_) {
+    tf::Quaternion robotQ = tf::createQuaternionFromYaw(rps.cur_loc.angle);
     // TODO(jaholtz) visualization should not always be based on car
     // parameters
     rps.robotPosMarker.pose.position.x =
@@ -382,49 +549,165 @@ void Simulator::publishOdometry() {
     rps.robotPosMarker.pose.orientation.y = robotQ.y();
     rps.robotPosMarker.pose.orientation.z = robotQ.z();
     rps.robotPosMarker.pose.orientation.w = robotQ.w();
+    rps.posMarkerPublisher.publish(rps.robotPosMarker);
   }
 }
 
 void Simulator::publishLaser() {
-  if (map_.file_name != CONFIG_map_name) {
-    map_.Load(CONFIG_map_name);
-    drawMap();
-  }
-
+  // Robots whose lasers are due on this step.
+  std::vector<int> robots;
   for (size_t i = 0; i < robot_pub_subs_.size(); ++i) {
+    if (scheduler_->Due(robot_pub_subs_[i].laser_task)) {
+      robots.push_back(i);
+    }
+  }
+  if (robots.empty()) return;
+
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  const ros::Time stamp = ros::Time::now();
+  const Vector2f laserRobotLoc(CONFIG_laser_x, CONFIG_laser_y);
+  const bool use_simd = (CONFIG_laser_scan_backend == "simd");
+  const float laser_stdev = CONFIG_laser_stdev;
+  const int num_scans = static_cast<int>(robots.size());
+
+  // The scans only read the map, and every robot writes to its own message
+  // with its own noise stream, so the robots are simulated in parallel, with
+  // results that do not depend on the number of threads.
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (int k = 0; k < num_scans; ++k) {
+    const int i = robots[k];
     auto& rps = robot_pub_subs_[i];
-    scanDataMsg.header.stamp = ros::Time::now();
-    scanDataMsg.header.frame_id = IndexToPrefix(i) + CONFIG_laser_frame;
-    const Vector2f laserRobotLoc(CONFIG_laser_x, CONFIG_laser_y);
+    sensor_msgs::LaserScan& msg = rps.scanDataMsg;
     const Vector2f laserLoc =
         rps.cur_loc.translation + Rotation2Df(rps.cur_loc.angle) * laserRobotLoc;
-
-    const int num_rays = static_cast<int>(
-        1.0 + (scanDataMsg.angle_max - scanDataMsg.angle_min) /
-        scanDataMsg.angle_increment);
-    map_.GetPredictedScan(laserLoc,
-                          scanDataMsg.range_min,
-                          scanDataMsg.range_max,
-                          scanDataMsg.angle_min + rps.cur_loc.angle,
-                          scanDataMsg.angle_max + rps.cur_loc.angle,
-                          num_rays,
-                          &scanDataMsg.ranges);
-    for (float& r : scanDataMsg.ranges) {
-      if (r > scanDataMsg.range_max - 0.1) {
+    if (use_simd) {
+      map_.GetPredictedScanSimd(laserLoc,
+                                msg.range_max,
+                                rps.cur_loc.angle,
+                                rps.laser_geometry,
+                                i,
+                                rps.scan_workspace.get(),
+                                &msg.ranges);
+    } else {
+      map_.GetPredictedScan(laserLoc,
+                            msg.range_max,
+                            rps.cur_loc.angle,
+                            rps.laser_geometry,
+                            i,
+                            rps.scan_workspace.get(),
+                            &msg.ranges);
+    }
+    for (float& r : msg.ranges) {
+      if (r > msg.range_max - 0.1) {
         r = 0;
         continue;
       }
-      r = max<float>(0.0, r + CONFIG_laser_stdev * laser_noise_(rng_));
+      r = max<float>(0.0, r + laser_stdev * rps.laser_noise(rps.laser_rng));
     }
+  }
 
+  for (const int i : robots) {
+    auto& rps = robot_pub_subs_[i];
+    rps.observed = true;
+    rps.scanDataMsg.header.stamp = stamp;
     // TODO Avoid publishing laser twice.
     // Currently publishes once for the visualizer and once for robot
     // requirements.
-    rps.laserPublisher.publish(scanDataMsg);
-    rps.vizLaserPublisher.publish(scanDataMsg);
+    rps.laserPublisher.publish(rps.scanDataMsg);
+    rps.vizLaserPublisher.publish(rps.scanDataMsg);
   }
 }
 
+void Simulator::updateMap() {
+  // The config is only read on this thread, and changes to map_name are
+  // passed on to the loader thread as requests.
+  if (CONFIG_map_name != map_name_) {
+    map_name_ = CONFIG_map_name;
+    map_loader_->Request(map_name_);
+  }
+  if (map_loader_->Generation() == map_generation_) {
+    return;
+  }
+  std::unique_ptr<VectorMap> map = map_loader_->Take(&map_generation_);
+  if (map == nullptr) {
+    return;
+  }
+  // Keep the current objects in the new map.
+  std::swap(map->object_index, map_.object_index);
+  map_ = std::move(*map);
+  if (flow_fields_ != nullptr) {
+    flow_fields_->Reset(map_, CONFIG_human_flow_field_save);
+    crowd_.BuildFlowFields(map_, flow_fields_.get());
+  }
+  drawMap();
+}
+
+bool Simulator::SetMapCallback(SimulatorSetMapSrv::Request& req,
+                               SimulatorSetMapSrv::Response& res) {
+  FILE* fid = fopen(req.map_name.c_str(), "r");
+  res.success = (fid != NULL);
+  if (fid == NULL) {
+    fprintf(stderr, "ERROR: Unable to open map %s\n", req.map_name.c_str());
+    return true;
+  }
+  fclose(fid);
+  map_loader_->Request(req.map_name);
+  return true;
+}
+
+bool Simulator::BatchScanCallback(SimulatorBatchScanSrv::Request& req,
+                                  SimulatorBatchScanSrv::Response& res) {
+  // Largest number of ranges returned by one request, to bound the memory
+  // and time a request can take.
+  static const double kMaxBatchRanges = 1 << 26;
+  if (!std::isfinite(req.angle_min) || !std::isfinite(req.angle_max) ||
+      !(req.angle_increment > 0.0) || req.angle_max < req.angle_min) {
+    fprintf(stderr, "ERROR: Invalid batch scan angles %f:%f:%f\n",
+            req.angle_min, req.angle_increment, req.angle_max);
+    return false;
+  }
+  if (!(req.range_max > 0.0) || !std::isfinite(req.range_max)) {
+    fprintf(stderr, "ERROR: Invalid batch scan range_max %f\n",
+            req.range_max);
+    return false;
+  }
+  // Count in double, since a tiny angle_increment overflows an int.
+  const double num_rays =
+      floor(1.0 + (req.angle_max - req.angle_min) / req.angle_increment);
+  if (num_rays > kMaxBatchRanges ||
+      num_rays * req.poses.size() > kMaxBatchRanges) {
+    fprintf(stderr, "ERROR: Batch scan of %zu poses with %.0f rays each "
+            "exceeds %.0f ranges\n",
+            req.poses.size(), num_rays, kMaxBatchRanges);
+    return false;
+  }
+  res.num_rays = static_cast<int>(num_rays);
+  const vector_map::ScanGeometry geometry(
+      req.angle_min, req.angle_max, res.num_rays);
+  vector<Vector2f> locs(req.poses.size());
+  vector<float> angles(req.poses.size());
+  for (size_t i = 0; i < req.poses.size(); ++i) {
+    locs[i] = Vector2f(req.poses[i].x, req.poses[i].y);
+    angles[i] = req.poses[i].theta;
+  }
+  // Robot i has id i in the object index.
+  const int ignore_object =
+      (req.ignore_robot >= 0 &&
+       req.ignore_robot < static_cast<int>(robot_pub_subs_.size())) ?
+      req.ignore_robot : -1;
+  map_.GetPredictedScans(locs,
+                         angles,
+                         req.range_max,
+                         geometry,
+                         ignore_object,
+                         &batch_scan_workspace_,
+                         &res.ranges);
+  return true;
+}
+
 void Simulator::publishTransform() {
   if (!CONFIG_publish_tfs) {
     return;
@@ -463,27 +746,45 @@ void Simulator::publishTransform() {
   }
 }
 
-void Simulator::publishVisualizationMarkers() {
-  mapLinesPublisher.publish(lineListMarker);
-  objectLinesPublisher.publish(objectLinesMarker);
-  for (auto& rps : robot_pub_subs_) {
-    rps.posMarkerPublisher.publish(rps.robotPosMarker);
-  }
-}
-
 void Simulator::update() {
   // Step the motion model forward one time step
   ++sim_step_count;
   sim_time += CONFIG_DT;
-  for (auto& rps : robot_pub_subs_) {
+  const int num_robots = static_cast<int>(robot_pub_subs_.size());
+  robot_motions_.resize(num_robots);
+  for (int i = 0; i < num_robots; ++i) {
+    auto& rps = robot_pub_subs_[i];
+    robot_motions_[i].object = i;
+    robot_motions_[i].start = rps.motion_model->GetPose();
+    rps.motion_model->SetSimTime(sim_time);
+    rps.step_command_count = rps.motion_model->GetCommandCount();
     rps.motion_model->Step(CONFIG_DT);
-    for (const Line2f& line: rps.motion_model->GetLines()){
-      map_.object_lines.push_back(line);
-    }
+    robot_motions_[i].end = rps.motion_model->GetPose();
+  }
+
+  // Update all map objects and their shapes in the object index, which only
+  // moves the objects that left their boxes in the index.
+  for (size_t i=0; i < objects.size(); i++){
+    objects[i]->Step(CONFIG_DT);
+    map_.object_index.Update(
+        num_robots + i, objects[i]->GetShape(), objects[i]->GetPose());
+  }
+  const int crowd_id = num_robots + objects.size();
+  crowd_.Step(CONFIG_DT, map_, crowd_id, flow_fields_.get());
+  for (int i = 0; i < crowd_.Size(); ++i) {
+    map_.object_index.Update(
+        crowd_id + i, crowd_.GetShape(i), crowd_.GetPose(i));
+  }
 
+  resolveCollisions();
+
+  for (int i = 0; i < num_robots; ++i) {
+    auto& rps = robot_pub_subs_[i];
     // Update the simulator with the motion model result.
     rps.cur_loc = rps.motion_model->GetPose();
     rps.vel = rps.motion_model->GetVel();
+    // Add the robot footprint to the map, so that other robots see it.
+    map_.object_index.Update(i, robot_shape_, rps.cur_loc);
 
     // Publishing the ground truth pose
     truePoseMsg.header.stamp = ros::Time::now();
@@ -496,16 +797,18 @@ void Simulator::update() {
     truePoseMsg.pose.orientation.y = 0;
     rps.truePosePublisher.publish(truePoseMsg);
   }
+}
 
-  // Update all map objects and get their lines
-  map_.object_lines.clear();
-  for (size_t i=0; i < objects.size(); i++){
-    objects[i]->Step(CONFIG_DT);
-    for (const Line2f& line: objects[i]->GetLines()){
-      map_.object_lines.push_back(line);
-    }
+void Simulator::resolveCollisions() {
+  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
+  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
+  collision_checker_->Resolve(map_, collision_response_, &robot_motions_);
+  for (size_t i = 0; i < robot_pub_subs_.size(); ++i) {
+    if (!robot_motions_[i].collided) continue;
+    robot_model::RobotModel& model = *robot_pub_subs_[i].motion_model;
+    model.SetPose(robot_motions_[i].end);
+    model.Stop();
   }
-  this->drawObjects();
 }
 
 string GetMapNameFromFilename(string path) {
@@ -532,19 +835,41 @@ void Simulator::publishLocalization() {
   }
 }
 
+void Simulator::publishClock() {
+  rosgraph_msgs::Clock clockMsg;
+  clockMsg.clock = ros::Time(sim_time);
+  clockPublisher.publish(clockMsg);
+}
+
 void Simulator::Run() {
+  // Swap in a new map if one finished loading.
+  updateMap();
+  for (auto& rps : robot_pub_subs_) {
+    rps.observed = false;
+  }
   // Simulate time-step.
   update();
+  // publish simulator time
+  if (CONFIG_publish_clock) {
+    publishClock();
+  }
   //publish odometry and status
-  publishOdometry();
-  //publish laser rangefinder messages
+  if (scheduler_->Due(odometry_task_)) {
+    publishOdometry();
+  }
+  //publish laser rangefinder messages of the robots whose lasers are due
   publishLaser();
   // publish visualization marker messages
-  publishVisualizationMarkers();
+  if (scheduler_->Due(visualization_task_)) {
+    publishVisualizationMarkers();
+  }
   //publish tf
-  publishTransform();
+  if (scheduler_->Due(tf_task_)) {
+    publishTransform();
+  }
 
-  if (FLAGS_localize) {
+  if (FLAGS_localize && scheduler_->Due(localization_task_)) {
     publishLocalization();
   }
+  scheduler_->Advance();
 }
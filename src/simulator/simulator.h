@@ -32,6 +32,7 @@
 #include "nav_msgs/Odometry.h"
 #include "ros/package.h"
 #include "ros/ros.h"
+#include "rosgraph_msgs/Clock.h"
 #include "sensor_msgs/LaserScan.h"
 #include "tf/transform_broadcaster.h"
 #include "tf/transform_datatypes.h"
@@ -39,16 +40,22 @@
 
 #include "ut_multirobot_sim/AckermannCurvatureDriveMsg.h"
 #include "ut_multirobot_sim/Localization2DMsg.h"
+#include "ut_multirobot_sim/SimulatorBatchScanSrv.h"
+#include "ut_multirobot_sim/SimulatorSetMapSrv.h"
 
 #include "shared/math/geometry.h"
 #include "shared/util/timer.h"
+#include "simulator/collision.h"
+#include "simulator/map_loader.h"
 #include "simulator/vector_map.h"
 #include "config_reader/config_reader.h"
 
+#include "crowd.h"
 #include "entity_base.h"
 #include "human_object.h"
 #include "robot_model.h"
 #include "short_term_object.h"
+#include "task_scheduler.h"
 
 #ifndef SIMULATOR_H
 #define SIMULATOR_H
@@ -61,6 +68,10 @@ class Simulator {
   config_reader::ConfigReader init_config_reader_;
 
   std::vector<std::unique_ptr<EntityBase>> objects;
+  // Humans simulated together, when the crowd engine is enabled, and the
+  // flow fields they follow over the map, if enabled.
+  human::Crowd crowd_;
+  std::unique_ptr<vector_map::FlowFieldCache> flow_fields_;
 
   struct RobotPubSub {
     Pose2Df vel;
@@ -74,21 +85,65 @@ class Simulator {
     ros::Publisher truePosePublisher;
     ros::Publisher localizationPublisher;
     std::unique_ptr<robot_model::RobotModel> motion_model;
+    // Commands the motion model had received when it was last stepped.
+    uint64_t step_command_count;
+    // Whether the last step published a scan or odometry to the robot, which
+    // its controller replies to with a drive command.
+    bool observed;
+    // Whether the robot has a controller that lockstep waits for, which is
+    // unset for the robots in --lockstep_ignore.
+    bool controlled;
 
     visualization_msgs::Marker robotPosMarker;
+
+    // Each robot has its own scan message and laser noise stream, so that
+    // the scans of all robots can be simulated concurrently.
+    sensor_msgs::LaserScan scanDataMsg;
+    vector_map::ScanGeometry laser_geometry;
+    std::unique_ptr<vector_map::ScanWorkspace> scan_workspace;
+    std::default_random_engine laser_rng;
+    std::normal_distribution<float> laser_noise;
+    // Task of the laser in scheduler_.
+    int laser_task;
   };
 
   ros::Publisher mapLinesPublisher;
   ros::Publisher objectLinesPublisher;
+  // Publishes sim_time on /clock, for nodes that run with use_sim_time.
+  ros::Publisher clockPublisher;
 
   std::vector<RobotPubSub> robot_pub_subs_;
 
   tf::TransformBroadcaster *br;
+  // Laser parameters shared by the scan messages of all robots.
   sensor_msgs::LaserScan scanDataMsg;
   nav_msgs::Odometry odometryTwistMsg;
   ut_multirobot_sim::Localization2DMsg localizationMsg;
 
+  // The map, and the shapes of robots and objects in its object index, where
+  // robot i has id i, objects[k] has id k plus the number of robots, and
+  // human k of the crowd follows after all objects.
   vector_map::VectorMap map_;
+  // Loads new maps in the background, and the generation of the loaded map
+  // that map_ was last swapped with.
+  std::unique_ptr<vector_map::MapLoader> map_loader_;
+  uint64_t map_generation_;
+  // Value of the map_name config when it was last checked, to request a new
+  // map when it changes.
+  std::string map_name_;
+  ros::ServiceServer setMapService;
+  // Simulates scans from arbitrary poses for other nodes, with the buffers in
+  // batch_scan_workspace_.
+  ros::ServiceServer batchScanService;
+  vector_map::BatchScanWorkspace batch_scan_workspace_;
+
+  // Collision checks for the robots, the configured response to collisions,
+  // and the motion of each robot over the current step.
+  std::unique_ptr<collision::CollisionChecker> collision_checker_;
+  collision::CollisionResponse collision_response_;
+  std::vector<collision::RobotMotion> robot_motions_;
+  // Footprint shared by all robots in the object index.
+  std::shared_ptr<const vector_map::Shape> robot_shape_;
 
   visualization_msgs::Marker lineListMarker;
   visualization_msgs::Marker objectLinesMarker;
@@ -96,12 +151,17 @@ class Simulator {
   static const float DT;
   geometry_msgs::PoseStamped truePoseMsg;
 
-  std::default_random_engine rng_;
-  std::normal_distribution<float> laser_noise_;
-
   uint64_t sim_step_count;
   double sim_time;
 
+  // Runs the sensors and publications at their configured periods, with
+  // the ids of the tasks other than the lasers of the robots.
+  std::unique_ptr<TaskScheduler> scheduler_;
+  int odometry_task_;
+  int tf_task_;
+  int localization_task_;
+  int visualization_task_;
+
  private:
   void initVizMarker(visualization_msgs::Marker &vizMarker, string ns, int id,
                      string type, geometry_msgs::PoseStamped p,
@@ -118,6 +178,14 @@ class Simulator {
   void publishVisualizationMarkers();
   void publishTransform();
   void publishLocalization();
+  void publishClock();
+  void updateMap();
+  void resolveCollisions();
+  bool SetMapCallback(ut_multirobot_sim::SimulatorSetMapSrv::Request& req,
+                      ut_multirobot_sim::SimulatorSetMapSrv::Response& res);
+  bool BatchScanCallback(
+      ut_multirobot_sim::SimulatorBatchScanSrv::Request& req,
+      ut_multirobot_sim::SimulatorBatchScanSrv::Response& res);
   void update();
   void loadObject();
 
@@ -130,5 +198,13 @@ class Simulator {
   double GetSimTime() const { return sim_time; }
   uint64_t GetSimStepCount() const { return sim_step_count; }
   double GetStepSize() const;
+  // True if every robot that the last step published an observation to
+  // received a drive command since, i.e. all controllers replied to it.
+  // Steps that publish no observations, between the sensor periods, do not
+  // wait for replies, and neither do robots without controllers.
+  bool CommandsReceived() const;
+  // Target ratio of simulator time to wall clock time, or zero to step as
+  // fast as possible.
+  double GetRealTimeFactor() const;
 };
 #endif  // SIMULATOR_H
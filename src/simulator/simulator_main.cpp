@@ -22,26 +22,43 @@
 #include <stdio.h>
 
 #include <iostream>
+#include <vector>
 
 #include "glog/logging.h"
 #include "gflags/gflags.h"
+#include "ros/callback_queue.h"
 #include "ros/ros.h"
 #include "std_msgs/Bool.h"
 #include "ut_multirobot_sim/SimulatorStateMsg.h"
+#include "ut_multirobot_sim/SimulatorStepMsg.h"
 
-#include "shared/util/timer.h"
 #include "simulator.h"
+#include "step_pacer.h"
 
 using ut_multirobot_sim::SimulatorStateMsg;
+using ut_multirobot_sim::SimulatorStepMsg;
 
 SimulatorStateMsg sim_state_;
 bool sim_step_ = false;
+// Multi-step commands received and not yet run, in the order received.
+std::vector<SimulatorStepMsg> step_commands_;
 
 DEFINE_string(sim_config, "config/sim_config.lua", "Path to sim config.");
+DEFINE_bool(lockstep, false, "Run in lockstep with the robot controllers, "
+            "stepping as soon as all robots that the last step published a "
+            "scan or odometry to received a drive command since. Robots "
+            "without controllers block it, unless listed in "
+            "--lockstep_ignore.");
+
+// State of the simulator when it is started.
+uint32_t StartedState() {
+  if (FLAGS_lockstep) return SimulatorStateMsg::SIM_LOCKSTEP;
+  return SimulatorStateMsg::SIM_RUNNING;
+}
 
 void SimStartStop(const std_msgs::Bool& msg) {
   if (msg.data) {
-    sim_state_.sim_state = SimulatorStateMsg::SIM_RUNNING;
+    sim_state_.sim_state = StartedState();
   } else {
     sim_state_.sim_state = SimulatorStateMsg::SIM_STOPPED;
   }
@@ -53,6 +70,26 @@ void SimStep(const std_msgs::Bool& msg) {
   sim_step_ = sim_step_ || msg.data;
 }
 
+void SimRunSteps(const SimulatorStepMsg& msg) {
+  step_commands_.push_back(msg);
+}
+
+// Runs the steps of a multi-step command back to back.
+void RunSteps(const SimulatorStepMsg& msg, Simulator* simulator) {
+  if (msg.until_time > 0) {
+    // Stop at the step closest to until_time, since the steps may not add up
+    // to it exactly.
+    const double end_time = msg.until_time - 0.5 * simulator->GetStepSize();
+    while (simulator->GetSimTime() < end_time && ros::ok()) {
+      simulator->Run();
+    }
+  } else {
+    for (uint64_t i = 0; i < msg.num_steps && ros::ok(); ++i) {
+      simulator->Run();
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   google::InitGoogleLogging(argv[0]);
   google::ParseCommandLineFlags(&argc, &argv, false);
@@ -63,7 +100,7 @@ int main(int argc, char **argv) {
 
   ros::Publisher sim_state_pub = n.advertise<SimulatorStateMsg>(
       "sim_state", 1, true);
-  sim_state_.sim_state = SimulatorStateMsg::SIM_RUNNING;
+  sim_state_.sim_state = StartedState();
 
   ros::Subscriber start_stop_sub = n.subscribe(
       "sim_start_stop", 1, SimStartStop);
@@ -71,37 +108,79 @@ int main(int argc, char **argv) {
   ros::Subscriber step_sub = n.subscribe(
       "sim_step", 1, SimStep);
 
+  ros::Subscriber run_steps_sub = n.subscribe(
+      "sim_run_steps", 10, SimRunSteps);
+
   Simulator simulator(FLAGS_sim_config);
   if (!simulator.init(n)) {
     return 1;
   }
 
   // main loop
-  RateLoop rate(1.0 / simulator.GetStepSize());
+  StepPacer pacer(simulator.GetRealTimeFactor());
+  const ros::WallDuration idle_time(simulator.GetStepSize());
   while (ros::ok()){
     ros::spinOnce();
-    switch (sim_state_.sim_state) {
-      case SimulatorStateMsg::SIM_RUNNING : {
-        simulator.Run();
-      } break;
-      case SimulatorStateMsg::SIM_STOPPED : {
-        // Do nothing unless stepping.
-        if (sim_step_) {
+    bool running = false;
+    bool waiting = false;
+    if (!step_commands_.empty()) {
+      // Multi-step commands take precedence in any state, and run without
+      // handling callbacks or pacing between steps.
+      for (const SimulatorStepMsg& msg : step_commands_) {
+        RunSteps(msg, &simulator);
+        sim_state_.step_id = msg.id;
+      }
+      step_commands_.clear();
+    } else {
+      switch (sim_state_.sim_state) {
+        case SimulatorStateMsg::SIM_RUNNING : {
           simulator.Run();
-          // Disable stepping until a step message is received.
-          sim_step_ = false;
+          running = true;
+        } break;
+        case SimulatorStateMsg::SIM_LOCKSTEP : {
+          // Step as soon as all controllers replied to the last observation.
+          // The first step, and step messages, publish an observation without
+          // waiting, to start the controllers.
+          if (sim_step_ ||
+              simulator.GetSimStepCount() == 0 ||
+              simulator.CommandsReceived()) {
+            simulator.Run();
+            sim_step_ = false;
+          } else {
+            waiting = true;
+          }
+        } break;
+        case SimulatorStateMsg::SIM_STOPPED : {
+          // Do nothing unless stepping.
+          if (sim_step_) {
+            simulator.Run();
+            // Disable stepping until a step message is received.
+            sim_step_ = false;
+          } else {
+            waiting = true;
+          }
+        } break;
+        default: {
+          LOG(FATAL) << "Unexpected simulator state: " << sim_state_.sim_state;
         }
-      } break;
-      default: {
-        LOG(FATAL) << "Unexpected simulator state: " << sim_state_.sim_state;
       }
     }
 
     // Publish simulator state.
     sim_state_.sim_step_count = simulator.GetSimStepCount();
     sim_state_.sim_time = simulator.GetSimTime();
+    sim_state_.real_time_factor = pacer.AchievedFactor();
     sim_state_pub.publish(sim_state_);
-    rate.Sleep();
+    if (running) {
+      pacer.Pace(simulator.GetSimTime());
+    } else {
+      pacer.Pause(simulator.GetSimTime());
+      // Wake up on the next message rather than after a fixed time, so that
+      // stepping is bounded only by the latency of the nodes driving it.
+      if (waiting) {
+        ros::getGlobalCallbackQueue()->callAvailable(idle_time);
+      }
+    }
   }
 
   printf("closing.\n");
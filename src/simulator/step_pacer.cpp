@@ -0,0 +1,71 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    step_pacer.cpp
+\brief   Paces simulator steps to a target real-time factor.
+*/
+//========================================================================
+
+#include <chrono>
+#include <thread>
+
+#include "shared/util/timer.h"
+#include "step_pacer.h"
+
+const double StepPacer::kMaxLag = 1.0;
+const double StepPacer::kMeasureInterval = 1.0;
+
+StepPacer::StepPacer(double target_factor) :
+    target_factor_(target_factor),
+    started_(false),
+    start_wall_time_(0),
+    start_sim_time_(0),
+    measure_wall_time_(GetMonotonicTime()),
+    measure_sim_time_(0),
+    achieved_factor_(0) {}
+
+void StepPacer::Pace(double sim_time) {
+  const double wall_time = GetMonotonicTime();
+  Measure(wall_time, sim_time);
+  if (target_factor_ <= 0) return;
+  if (!started_) {
+    started_ = true;
+    start_wall_time_ = wall_time;
+    start_sim_time_ = sim_time;
+    return;
+  }
+  const double due_time =
+      start_wall_time_ + (sim_time - start_sim_time_) / target_factor_;
+  if (due_time > wall_time) {
+    std::this_thread::sleep_for(
+        std::chrono::duration<double>(due_time - wall_time));
+  } else if (wall_time - due_time > kMaxLag) {
+    start_wall_time_ = wall_time;
+    start_sim_time_ = sim_time;
+  }
+}
+
+void StepPacer::Pause(double sim_time) {
+  started_ = false;
+  Measure(GetMonotonicTime(), sim_time);
+}
+
+void StepPacer::Measure(double wall_time, double sim_time) {
+  if (wall_time - measure_wall_time_ < kMeasureInterval) return;
+  achieved_factor_ =
+      (sim_time - measure_sim_time_) / (wall_time - measure_wall_time_);
+  measure_wall_time_ = wall_time;
+  measure_sim_time_ = sim_time;
+}
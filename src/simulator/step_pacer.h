@@ -0,0 +1,65 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    step_pacer.h
+\brief   Paces simulator steps to a target real-time factor.
+*/
+//========================================================================
+
+#ifndef SRC_SIMULATOR_STEP_PACER_H_
+#define SRC_SIMULATOR_STEP_PACER_H_
+
+// Paces simulator steps to a target real-time factor, the ratio of simulator
+// time to wall clock time, and measures the factor actually achieved. Steps
+// are due at fixed wall clock times from when pacing started, so steps that
+// overrun are caught up by the steps after them instead of delaying every
+// following step.
+class StepPacer {
+ public:
+  // A target factor of zero steps as fast as possible.
+  explicit StepPacer(double target_factor);
+
+  // Call after each step with the simulator time it reached, to sleep until
+  // that time is due on the wall clock. Returns right away if the step is
+  // late. Steps more than kMaxLag seconds late restart pacing from the
+  // current time, rather than catching up all at once.
+  void Pace(double sim_time);
+
+  // Call while the simulator is not stepping, so that the time spent paused
+  // is not caught up once stepping resumes.
+  void Pause(double sim_time);
+
+  // Simulator time per wall clock time over the last measured interval.
+  double AchievedFactor() const { return achieved_factor_; }
+
+ private:
+  void Measure(double wall_time, double sim_time);
+
+  static const double kMaxLag;
+  // Wall clock time over which the achieved factor is measured.
+  static const double kMeasureInterval;
+
+  const double target_factor_;
+  // Wall clock and simulator times that pacing started from, if started.
+  bool started_;
+  double start_wall_time_;
+  double start_sim_time_;
+  // Start of the current measurement interval.
+  double measure_wall_time_;
+  double measure_sim_time_;
+  double achieved_factor_;
+};
+
+#endif  // SRC_SIMULATOR_STEP_PACER_H_
@@ -0,0 +1,38 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    task_scheduler.cpp
+\brief   Schedules periodic tasks of the simulator at their own rates.
+*/
+//========================================================================
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "task_scheduler.h"
+
+TaskScheduler::TaskScheduler(double step_size) :
+    step_size_(step_size), step_(0) {}
+
+int TaskScheduler::Add(double period, int phase) {
+  Task task;
+  task.period = static_cast<uint64_t>(
+      std::max(1.0, round(period / step_size_)));
+  task.phase = static_cast<uint64_t>(std::max(phase, 0)) % task.period;
+  tasks_.push_back(task);
+  return static_cast<int>(tasks_.size()) - 1;
+}
@@ -0,0 +1,67 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    task_scheduler.h
+\brief   Schedules periodic tasks of the simulator at their own rates.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <vector>
+
+#ifndef SRC_SIMULATOR_TASK_SCHEDULER_H_
+#define SRC_SIMULATOR_TASK_SCHEDULER_H_
+
+// Periodic tasks of the simulator, such as sensors and publications, which
+// each run at their own rate instead of on every step. Periods are whole
+// numbers of steps, so that a task is due on the same steps however fast the
+// simulator runs.
+class TaskScheduler {
+ public:
+  explicit TaskScheduler(double step_size);
+
+  // Adds a task due every period seconds of simulator time, rounded to a
+  // whole number of steps, and returns its id. Periods shorter than a step
+  // are due every step. The phase, in steps, staggers tasks of the same
+  // period, such as the lasers of different robots, so that they are not
+  // all due on the same step.
+  int Add(double period, int phase);
+
+  // True if the task is due on the current step.
+  bool Due(int task) const {
+    return step_ % tasks_[task].period == tasks_[task].phase;
+  }
+
+  // Period of the task after rounding, in seconds.
+  double Period(int task) const {
+    return tasks_[task].period * step_size_;
+  }
+
+  // Moves on to the next step.
+  void Advance() { ++step_; }
+
+ private:
+  struct Task {
+    uint64_t period;
+    uint64_t phase;
+  };
+
+  const double step_size_;
+  uint64_t step_;
+  std::vector<Task> tasks_;
+};
+
+#endif  // SRC_SIMULATOR_TASK_SCHEDULER_H_
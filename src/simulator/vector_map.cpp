@@ -20,11 +20,18 @@
 //========================================================================
 
 #include "stdio.h"
+#include <stdint.h>
 
 #include <algorithm>
+#include <limits>
+#include <set>
 #include <utility>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "eigen3/Eigen/Dense"
 #include "eigen3/Eigen/Geometry"
 
@@ -32,10 +39,10 @@
 #include "shared/math/line2d.h"
 #include "shared/math/math_util.h"
 #include "shared/util/timer.h"
+#include "map_cache.h"
 #include "vector_map.h"
 
 using math_util::AngleMod;
-using math_util::RadToDeg;
 using geometry::Cross;
 using geometry::Line;
 using geometry::Line2f;
@@ -44,317 +51,322 @@ using std::vector;
 using Eigen::Vector2f;
 using std::swap;
 
-#define PRINT_LINE(LINE) \
-    (LINE).p0.x(), (LINE).p0.y(), \
-    (LINE).p1.x(), (LINE).p1.y()
+namespace vector_map {
 
-#define PRINT_VEC2(V) (V).x(), (V).y()
+void VectorMap::GetSceneLines(const Vector2f& loc,
+                              float max_range,
+                              vector<Line2f>* lines_list) const {
+  vector<int> candidates;
+  GetSceneLines(loc, max_range, -1, &candidates, lines_list);
+}
 
-namespace vector_map {
+namespace {
+// True if the bounding box of l overlaps the box [box_min, box_max].
+bool InBox(const Line2f& l, const Vector2f& box_min, const Vector2f& box_max) {
+  if (l.p0.x() < box_min.x() && l.p1.x() < box_min.x()) return false;
+  if (l.p0.y() < box_min.y() && l.p1.y() < box_min.y()) return false;
+  if (l.p0.x() > box_max.x() && l.p1.x() > box_max.x()) return false;
+  if (l.p0.y() > box_max.y() && l.p1.y() > box_max.y()) return false;
+  return true;
+}
+}  // namespace
 
-void TrimOcclusion(const Vector2f& loc,
-                   const Line2f& test_line,
-                   Line2f* trim_line_ptr,
-                   vector<Line2f>* scene_lines_ptr) {
-  // return TrimOcclusionInt(loc, test_line, trim_line_ptr, scene_lines_ptr);
-  static const bool kDebug = false;
-  Line2f& trim_line = *trim_line_ptr;
-  if (kDebug) {
-    printf("%s:\n", __FUNCTION__);
-    printf("TestLine: %f,%f %f,%f\n", PRINT_LINE(test_line));
-    printf("TrimLine: %f,%f %f,%f\n", PRINT_LINE(trim_line));
-    printf("Loc: %f, %f\n", PRINT_VEC2(loc));
-  }
-  vector<Line2f>& scene_lines = *scene_lines_ptr;
-  static const float sqeps = 1e-8;
-
-  // test_line.p0
-  Vector2f l1_p0 = test_line.p0;
-  // test_line.p1
-  Vector2f l1_p1 = test_line.p1;
-  // test_line.p0 - loc
-  Vector2f l1_r0 = l1_p0 - loc;
-  // test_line.p1 - loc
-  Vector2f l1_r1 = l1_p1 - loc;
-  // trim_line.p0
-  Vector2f l2_p0 = trim_line.p0;
-  // trim_line.p1
-  Vector2f l2_p1 = trim_line.p1;
-  // trim_line.p0 - loc
-  Vector2f l2_r0 = l2_p0 - loc;
-  // trim_line.p1 - loc
-  Vector2f l2_r1 = l2_p1 - loc;
-
-  //Ensure that r0 vector to r1 vector is in the positive right-handed order
-  if (Cross<float>(l1_r0, l1_r1) < 0.0) {
-    swap(l1_r0,l1_r1);
-    swap(l1_p0,l1_p1);
-  }
-  if (Cross<float>(l2_r0, l2_r1) < 0.0 ) {
-    swap(l2_r0,l2_r1);
-    swap(l2_p0,l2_p1);
-  }
-
-  if (kDebug) {
-    printf("l1_r0:%f,%f l1_r1:%f,%f\nl2_r0:%f,%f l2_r1:%f,%f\n",
-           PRINT_VEC2(l1_r0),
-           PRINT_VEC2(l1_r1),
-           PRINT_VEC2(l2_r0),
-           PRINT_VEC2(l2_r1));
-  }
-  if ((Cross(l1_r0, l2_r0) >= 0.0 && Cross(l1_r1, l2_r0) >= 0.0) ||
-      (Cross(l2_r0, l1_r0) >= 0.0 && Cross(l2_r1, l1_r0) >= 0.0)) {
-    // No Line interaction.
-    if (kDebug) {
-      printf("No line interaction\n");
-    }
-    return;
-  }
+void VectorMap::GetSceneLines(const Vector2f& loc,
+                              float max_range,
+                              int ignore_object,
+                              vector<int>* candidates,
+                              vector<Line2f>* lines_list) const {
+  GetSceneLinesInBox(loc,
+                     max_range,
+                     loc - Vector2f(max_range, max_range),
+                     loc + Vector2f(max_range, max_range),
+                     ignore_object,
+                     candidates,
+                     lines_list);
+}
 
-  // The semi-infinite ray from loc and passing through test_line.p0 intersects
-  // the trim_line.
-  const bool rayOcclusion0 = trim_line.RayIntersects(loc, l1_r0);
-  // The semi-infinite ray from loc and passing through test_line.p1 intersects
-  // trim_line.
-  const bool rayOcclusion1 = trim_line.RayIntersects(loc, l1_r1);
-
-  if (kDebug) {
-    printf("rayOcclusion0:%d rayOcclusion1:%d\n",
-           rayOcclusion0,
-           rayOcclusion1);
-  }
-
-  // Vector2f p;
-  const bool completeOcclusion =
-      test_line.Intersects(loc, l2_p0) && test_line.Intersects(loc, l2_p1);
-
-  // test_line.p0 is in front of, and occludes trim_line.
-  const bool occlusion0 = rayOcclusion0 &&
-      (trim_line.Touches(loc) || trim_line.Touches(l1_p0) ||
-      !trim_line.Intersects(loc, l1_p0));
-
-  // test_line.p1 is in front of, and occludes trim_line.
-  const bool occlusion1 = rayOcclusion1 &&
-      (trim_line.Touches(loc) || trim_line.Touches(l1_p1) ||
-      !trim_line.Intersects(loc, l1_p1));
-
-  if (kDebug) {
-    printf("completeOcclusion:%d occlusion0:%d occlusion1:%d\n",
-            completeOcclusion,
-            occlusion0,
-            occlusion1);
-    printf("crosses0:%d crosses1:%d\n",
-            trim_line.Crosses(loc, l1_p0),
-            trim_line.Crosses(loc, l1_p1));
-  }
-  if (completeOcclusion) {
-    if (kDebug) {
-      printf("Case 2: trim line completely occluded by test line\n");
-    }
-    // Trim the line to zero length.
-    trim_line.Set(Vector2f(0.1, 0.1), Vector2f(0.1, 0.1));
-    return;
-  } else if (occlusion0 && occlusion1) {
-    if (kDebug) printf("Case 3: partial occlusion in middle\n");
-    // trim_line is partially occluded in the middle by test_line. Break up
-    // into 2 segments, make trim_line one segment, push back the other
-    // segment to the sceneLines list.
-    const Vector2f right_section_end = trim_line.RayIntersection(loc, l1_r0);
-    const Vector2f left_section_end = trim_line.RayIntersection(loc, l1_r1);
-    if (kDebug) {
-      printf("Right: %f,%f  Left: %f,%f\n",
-              right_section_end.x(),
-              right_section_end.y(),
-              left_section_end.x(),
-              left_section_end.y());
-    }
-    trim_line.Set(l2_p0, right_section_end);
-    // save the unoccluded part of trim_line at its left hand end, if any
-    if ((left_section_end - l2_p1).squaredNorm() > sqeps) {
-      scene_lines.push_back(Line2f(left_section_end, l2_p1));
+void VectorMap::GetSceneLinesInBox(const Vector2f& loc,
+                                   float max_range,
+                                   const Vector2f& box_min,
+                                   const Vector2f& box_max,
+                                   int ignore_object,
+                                   vector<int>* candidates,
+                                   vector<Line2f>* lines_list) const {
+  GetMapLinesInBox(loc, max_range, box_min, box_max, candidates, lines_list);
+  GetObjectLinesInBox(box_min, box_max, ignore_object, lines_list);
+}
+
+void VectorMap::GetMapLinesInBox(const Vector2f& loc,
+                                 float max_range,
+                                 const Vector2f& box_min,
+                                 const Vector2f& box_max,
+                                 vector<int>* candidates,
+                                 vector<Line2f>* lines_list) const {
+  const int* visible_set = nullptr;
+  int visible_set_size = 0;
+  if (VisibilityCacheCurrent() &&
+      max_range <= visibility_cache.MaxRange() &&
+      visibility_cache.Lookup(loc, &visible_set, &visible_set_size)) {
+    lines_list->clear();
+    for (int k = 0; k < visible_set_size; ++k) {
+      const Line2f& l = lines[visible_set[k]];
+      if (InBox(l, box_min, box_max)) lines_list->push_back(l);
     }
-  } else if (occlusion0) {
-    if (kDebug) printf("Case 5: left end occluded\n");
-    //The left hand end of trim_line is occluded, trim it
-    Vector2f right_section_end = trim_line.RayIntersection(loc, l1_r0);
-    trim_line.Set(l2_p0, right_section_end);
-  } else if (occlusion1) {
-    if (kDebug) printf("Case 6: right end occluded\n");
-    //The right hand end of trim_line is occluded, trim it
-    Vector2f left_section_end = trim_line.RayIntersection(loc, l1_r1);
-    trim_line.Set(left_section_end, l2_p1);
   } else {
-    if (kDebug) printf("Case 7\n");
+    GetGridLinesInBox(box_min, box_max, candidates, lines_list);
   }
 }
 
-
-void VectorMap::GetSceneLines(const Vector2f& loc,
-                              float max_range,
+void VectorMap::GetLinesInBox(const Vector2f& box_min,
+                              const Vector2f& box_max,
+                              int ignore_object,
+                              vector<int>* candidates,
                               vector<Line2f>* lines_list) const {
-  const float x_min = loc.x() - max_range;
-  const float y_min = loc.y() - max_range;
-  const float x_max = loc.x() + max_range;
-  const float y_max = loc.y() + max_range;
+  GetGridLinesInBox(box_min, box_max, candidates, lines_list);
+  GetObjectLinesInBox(box_min, box_max, ignore_object, lines_list);
+}
+
+void VectorMap::GetGridLinesInBox(const Vector2f& box_min,
+                                  const Vector2f& box_max,
+                                  vector<int>* candidates,
+                                  vector<Line2f>* lines_list) const {
   lines_list->clear();
-  for (const Line2f& l : lines) {
-    if (l.p0.x() < x_min && l.p1.x() < x_min) continue;
-    if (l.p0.y() < y_min && l.p1.y() < y_min) continue;
-    if (l.p0.x() > x_max && l.p1.x() > x_max) continue;
-    if (l.p0.y() > y_max && l.p1.y() > y_max) continue;
-    lines_list->push_back(l);
-  }
-  // Add object lines
-  for (const Line2f& l : object_lines){
-    if (l.p0.x() < x_min && l.p1.x() < x_min) continue;
-    if (l.p0.y() < y_min && l.p1.y() < y_min) continue;
-    if (l.p0.x() > x_max && l.p1.x() > x_max) continue;
-    if (l.p0.y() > y_max && l.p1.y() > y_max) continue;
-    lines_list->push_back(l);
-  }
-}
-
-void VectorMap::SceneRender(const Vector2f& loc,
-                            float max_range,
-                            float angle_min,
-                            float angle_max,
-                            vector<Line2f>* render) const {
-  static const float eps = 0.0001;
-  static const unsigned int MaxLines = 2000;
-  vector<Line2f> scene;
-  vector<Line2f> lines_list;
-  GetSceneLines(loc, max_range, &lines_list);
-  render->clear();
-
-  for(size_t i = 0; i < lines_list.size() && i < MaxLines; ++i) {
-    Line2f cur_line = lines_list[i];
-    // Check if any part of cur_line is unoccluded by present list of lines,
-    // as seen from loc.
-    for(size_t j = 0; j < scene.size() && cur_line.SqLength() >= eps; ++j) {
-      if (scene[j].SqLength() < eps) continue;
-      TrimOcclusion(loc, scene[j], &cur_line, &lines_list);
+  if (IndexCurrent()) {
+    candidates->clear();
+    line_grid.QueryBox(box_min, box_max, candidates);
+    for (const int i : *candidates) {
+      const Line2f& l = lines[i];
+      if (InBox(l, box_min, box_max)) lines_list->push_back(l);
     }
-
-    if (cur_line.SqLength() > eps) { //At least part of cur_line is unoccluded
-      for(size_t j = 0; j < scene.size(); ++j) {
-        if (scene[j].SqLength() < eps) continue;
-        TrimOcclusion(loc, cur_line, &scene[j], &lines_list);
-      }
-      // Add the visible part of cur_line.
-      scene.push_back(cur_line);
+  } else {
+    for (const Line2f& l : lines) {
+      if (InBox(l, box_min, box_max)) lines_list->push_back(l);
     }
   }
+}
 
-  if (lines_list.size() >= MaxLines) {
-    fprintf(stderr,
-            "Runaway Analytic Scene Render at %.30f,%.30f, %.3f : %.3f\u00b0\n",
-            loc.x(), loc.y(),
-            RadToDeg(angle_min),
-            RadToDeg(angle_max));
-  }
-  for(const Line2f& l : scene) {
-    if (l.SqLength() > eps) render->push_back(l);
-  }
+void VectorMap::GetObjectLinesInBox(const Vector2f& box_min,
+                                    const Vector2f& box_max,
+                                    int ignore_object,
+                                    vector<Line2f>* lines_list) const {
+  object_index.Query(box_min, box_max, [&](int id) {
+    if (id == ignore_object) return;
+    const ShapeView view = object_index.View(id);
+    for (int k = 0; k < view.NumLines(); ++k) {
+      const Line2f l = view.Line(k);
+      if (InBox(l, box_min, box_max)) lines_list->push_back(l);
+    }
+  });
 }
 
-int GetRayIntersection(const Vector2f& loc,
-                       const size_t skip_line_idx,
-                       const vector<Line2f>& lines_list,
-                       Vector2f* ray_end) {
-  Vector2f intersection(0, 0);
-  int intersecting_line_idx = -1;
-  for (size_t i = 0; i < lines_list.size(); ++i) {
-    if (i == skip_line_idx) continue;
-    const Line2f& l = lines_list[i];
-    if (l.Intersection(loc, *ray_end, &intersection)) {
-      *ray_end = intersection;
-      intersecting_line_idx = i;
+void VectorMap::GetObjectCirclesInBox(const Vector2f& box_min,
+                                      const Vector2f& box_max,
+                                      int ignore_object,
+                                      vector<Circle>* circles) const {
+  circles->clear();
+  object_index.Query(box_min, box_max, [&](int id) {
+    if (id == ignore_object) return;
+    const ShapeView view = object_index.View(id);
+    for (int k = 0; k < view.NumCircles(); ++k) {
+      const Circle c = view.GetCircle(k);
+      if (c.InBox(box_min, box_max)) circles->push_back(c);
     }
-  }
-  return intersecting_line_idx;
+  });
 }
 
-void VectorMap::RayCast(const Vector2f& loc,
-                        float max_range,
-                        vector<Line2f>* render) const {
-  static const float kEpsilon = 1e-4;
+namespace {
+// Range along the ray with direction dir to the line through segment s.
+float RangeAlong(const Vector2f& dir, const SweepSegment& s) {
+  const Vector2f e = s.p1 - s.p0;
+  return Cross(s.p0, e) / Cross(dir, e);
+}
 
-  // Small optimization: ignore all lines not within max_range.
-  vector<Line2f> lines_list;
-  GetSceneLines(loc, max_range, &lines_list);
+// Point on segment s along the ray at angle a.
+Vector2f PointAt(float a, const SweepSegment& s) {
+  if (a == s.a0) return s.p0;
+  if (a == s.a1) return s.p1;
+  const Vector2f dir(cos(a), sin(a));
+  return RangeAlong(dir, s) * dir;
+}
 
-  // NOTE(joydeep): In this function, "iidx" refers to the index of
-  // the line segment from lines_list that intersects with the associated
-  // ray.
+void AddSweepSegment(const Vector2f& r0,
+                     const Vector2f& r1,
+                     float a0,
+                     float a1,
+                     int id,
+                     vector<SweepSegment>* segments) {
+  if (!(a0 < a1)) return;
+  SweepSegment s;
+  s.p0 = r0;
+  s.p1 = r1;
+  s.a0 = a0;
+  s.a1 = a1;
+  s.id = id;
+  segments->push_back(s);
+}
+}  // namespace
 
-  struct RayCastRay {
-    Vector2f ray_end;
-    int iidx;
-    RayCastRay(const Vector2f& ray_end, int iidx) :
-        ray_end(ray_end), iidx(iidx) {}
-  };
-  // Go through all lines, and check for intersection of rays.
-  vector<RayCastRay> ray_cast_rays;
-  for (size_t i = 0; i < lines_list.size(); ++i) {
-    const Line2f& l = lines_list[i];
-    const Vector2f dir = kEpsilon * (l.p1 - l.p0).normalized();
-
-    // Add rays from loc to just inside of the line segment.
-    Vector2f r0 = l.p0 + dir;
-    Vector2f r1 = l.p1 - dir;
-    int r0_iidx = GetRayIntersection(loc, i, lines_list, &r0);
-    int r1_iidx = GetRayIntersection(loc, i, lines_list, &r1);
-    if (r0_iidx < 0) r0_iidx = i;
-    if (r1_iidx < 0) r1_iidx = i;
-    ray_cast_rays.push_back(RayCastRay(r0, r0_iidx));
-    ray_cast_rays.push_back(RayCastRay(r1, r1_iidx));
-
-    // Add rays from loc to max_range just past the line segment.
-    Vector2f end_p0 = loc + (l.p0 - dir - loc).normalized() * max_range;
-    Vector2f end_p1 = loc + (l.p1 + dir - loc).normalized() * max_range;
-    const int end_p0_iidx = GetRayIntersection(loc, i, lines_list, &end_p0);
-    const int end_p1_iidx = GetRayIntersection(loc, i, lines_list, &end_p1);
-    if (end_p0_iidx >= 0) {
-      ray_cast_rays.push_back(RayCastRay(end_p0, end_p0_iidx));
+void SplitCrossings(size_t first, vector<Line2f>* lines_ptr) {
+  vector<Line2f>& lines = *lines_ptr;
+  // Parts split off are appended, and tested in turn against all lines
+  // before them, until no pair crosses.
+  for (size_t i = first; i < lines.size(); ++i) {
+    Vector2f a_min = lines[i].p0.cwiseMin(lines[i].p1);
+    Vector2f a_max = lines[i].p0.cwiseMax(lines[i].p1);
+    for (size_t j = 0; j < i; ++j) {
+      const Line2f& b = lines[j];
+      if (!InBox(b, a_min, a_max)) continue;
+      const Line2f& a = lines[i];
+      const Vector2f da = a.p1 - a.p0;
+      const Vector2f db = b.p1 - b.p0;
+      const float denom = Cross(da, db);
+      // Parallel lines never cross, even when they overlap.
+      if (denom == 0.0) continue;
+      const Vector2f d = b.p0 - a.p0;
+      const float ta = Cross(d, db) / denom;
+      const float tb = Cross(d, da) / denom;
+      // Lines that only touch at an endpoint do not need to be split.
+      if (!(ta > 0.0 && ta < 1.0 && tb > 0.0 && tb < 1.0)) continue;
+      // Both lines are split at the same point, so that their parts meet
+      // exactly there.
+      const Vector2f p = a.p0 + ta * da;
+      const Line2f a_rest(p, a.p1);
+      const Line2f b_rest(p, b.p1);
+      lines[i].p1 = p;
+      lines[j].p1 = p;
+      lines.push_back(a_rest);
+      lines.push_back(b_rest);
+      a_min = lines[i].p0.cwiseMin(p);
+      a_max = lines[i].p0.cwiseMax(p);
     }
-    if (end_p1_iidx >= 0) {
-      ray_cast_rays.push_back(RayCastRay(end_p1, end_p1_iidx));
+  }
+}
+
+bool SweepOrder::operator()(int i, int j) const {
+  const float ri = RangeAlong(*dir, (*segments)[i]);
+  const float rj = RangeAlong(*dir, (*segments)[j]);
+  if (ri != rj) return ri < rj;
+  return i < j;
+}
+
+void VisibleSegments(const Vector2f& loc,
+                     const vector<Line2f>& lines,
+                     vector<Line2f>* visible,
+                     vector<int>* line_ids) {
+  SweepWorkspace workspace;
+  VisibleSegments(loc, lines, &workspace, visible, line_ids);
+}
+
+void VisibleSegments(const Vector2f& loc,
+                     const vector<Line2f>& lines,
+                     SweepWorkspace* workspace,
+                     vector<Line2f>* visible,
+                     vector<int>* line_ids) {
+  static const float kEpsilon = 1e-8;
+  static const float kPi = M_PI;
+  visible->clear();
+  if (line_ids != nullptr) line_ids->clear();
+
+  vector<SweepSegment>& segments = workspace->segments;
+  segments.clear();
+  for (size_t i = 0; i < lines.size(); ++i) {
+    Vector2f r0 = lines[i].p0 - loc;
+    Vector2f r1 = lines[i].p1 - loc;
+    const float c = Cross(r0, r1);
+    // Segments seen edge-on have no angular extent, and cannot occlude
+    // anything.
+    if (fabs(c) <= kEpsilon * r0.norm() * r1.norm()) continue;
+    if (c < 0.0) swap(r0, r1);
+    float a0 = atan2(r0.y(), r0.x());
+    float a1 = atan2(r1.y(), r1.x());
+    if (r0.y() >= 0.0 && r1.y() < 0.0) {
+      // The segment crosses the start of the sweep at angle -pi, split it.
+      Vector2f p = r0 + (r1 - r0) * (r0.y() / (r0.y() - r1.y()));
+      p.y() = 0.0;
+      if (r0.y() == 0.0) a0 = kPi;
+      AddSweepSegment(r0, p, a0, kPi, i, &segments);
+      AddSweepSegment(p, r1, -kPi, a1, i, &segments);
+    } else {
+      // An endpoint on the negative x axis may have been assigned either of
+      // -pi or pi.
+      if (a1 < a0) {
+        if (r0.y() == 0.0) {
+          a0 = -kPi;
+        } else {
+          a1 = kPi;
+        }
+      }
+      AddSweepSegment(r0, r1, a0, a1, i, &segments);
     }
   }
+  if (segments.empty()) return;
 
-  if (true) {
-    struct Comparator{
-      bool operator() (RayCastRay r1, RayCastRay r2) {
-        // if (r1.iidx <= r2.iidx) return true;
-        const Vector2f l1 = r1.ray_end - loc;
-        const Vector2f l2 = r2.ray_end - loc;
-        return (Cross(l1, l2) > 0.0);
-        return false;
-      };
-      Vector2f loc;
-    };
-    Comparator comparator;
-    comparator.loc = loc;
-    /*
-    const auto comparator = [loc](const RayCastRay& r1, const RayCastRay& r2) {
-      if (r1.iidx < r2.iidx) return true;
-      const Vector2f l1 = r1.ray_end - loc;
-      const Vector2f l2 = r2.ray_end - loc;
-      return (Cross(l1, l2) > 0.0);
-      return false;
-    };
-    */
-    sort(ray_cast_rays.begin(), ray_cast_rays.end(), comparator);
+  vector<SweepEvent>& events = workspace->events;
+  events.clear();
+  for (size_t i = 0; i < segments.size(); ++i) {
+    events.push_back({segments[i].a0, true, static_cast<int>(i)});
+    events.push_back({segments[i].a1, false, static_cast<int>(i)});
   }
+  sort(events.begin(), events.end());
+
+  Vector2f dir(1, 0);
+  SweepOrder order;
+  order.segments = &segments;
+  order.dir = &dir;
+  SweepActiveSet active(order,
+                        PoolAllocator<int>(&workspace->active_nodes));
+  vector<SweepActiveSet::iterator>& position = workspace->position;
+  position.assign(segments.size(), active.end());
 
-  if (ray_cast_rays.size() < 2) return;
-  for (size_t i = 0; i < ray_cast_rays.size(); ++i) {
-    if (ray_cast_rays[i].ray_end != ray_cast_rays[i - 1].ray_end) {
-      render->push_back(Line2f(loc, ray_cast_rays[i].ray_end));
+  int front = -1;
+  float front_angle = 0;
+  for (size_t i = 0; i < events.size();) {
+    const float angle = events[i].angle;
+    // Evaluate the order of segments halfway to the next event, where every
+    // active segment is strictly within its angular extent.
+    size_t j = i;
+    while (j < events.size() && events[j].angle == angle) ++j;
+    if (j < events.size()) {
+      const float mid = 0.5 * (angle + events[j].angle);
+      dir = Vector2f(cos(mid), sin(mid));
+    }
+    for (; i < j; ++i) {
+      const SweepEvent& e = events[i];
+      if (e.start) {
+        position[e.segment] = active.insert(e.segment).first;
+      } else if (position[e.segment] != active.end()) {
+        active.erase(position[e.segment]);
+        position[e.segment] = active.end();
+      }
+    }
+    const int new_front = active.empty() ? -1 : *active.begin();
+    if (new_front == front) continue;
+    if (front >= 0) {
+      const SweepSegment& s = segments[front];
+      visible->push_back(Line2f(loc + PointAt(front_angle, s),
+                                loc + PointAt(angle, s)));
+      if (line_ids != nullptr) line_ids->push_back(s.id);
     }
+    front = new_front;
+    front_angle = angle;
   }
 }
 
+void VectorMap::RayCast(const Vector2f& loc,
+                        float max_range,
+                        vector<Line2f>* render) const {
+  const Vector2f box_min = loc - Vector2f(max_range, max_range);
+  const Vector2f box_max = loc + Vector2f(max_range, max_range);
+  vector<int> candidates;
+  vector<Line2f> lines_list;
+  GetMapLinesInBox(
+      loc, max_range, box_min, box_max, &candidates, &lines_list);
+  const size_t num_map_lines = lines_list.size();
+  GetObjectLinesInBox(box_min, box_max, -1, &lines_list);
+  SplitCrossings(num_map_lines, &lines_list);
+  VisibleSegments(loc, lines_list, render, nullptr);
+}
+
 
 void ShrinkLine(float distance, Line2f* line) {
   const float len = line->Length();
@@ -368,15 +380,73 @@ void VectorMap::Cleanup() {
   const float kShrinkDistance = 1e-4;
   // const float kMinLineLength = 2.0 * kShrinkDistance;
   const float kMinLineLength = 0.05;
+  // Margin added to query boxes, so that lines that only intersect within
+  // floating point tolerance are still tested against each other.
+  const float kQueryMargin = 1e-3;
+  // Largest number of cells along each side of the grid.
+  const int kMaxCellsPerSide = 1024;
+  if (lines.empty()) return;
+
+  // Bucket the accepted lines in a uniform grid over the map, so that each
+  // line is only tested against the accepted lines near it. Candidates are
+  // tested in the order they were accepted, so the first intersecting line
+  // found is the same as when testing against all of them.
+  Vector2f bmin = lines[0].p0;
+  Vector2f bmax = lines[0].p0;
+  for (const Line2f& l : lines) {
+    bmin = bmin.cwiseMin(l.p0).cwiseMin(l.p1);
+    bmax = bmax.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  const Vector2f extent = bmax - bmin;
+  float cell_size = std::max<float>(
+      sqrt(extent.x() * extent.y() / static_cast<float>(lines.size())),
+      extent.maxCoeff() / static_cast<float>(kMaxCellsPerSide));
+  if (!(cell_size > 0.0)) cell_size = 1.0;
+  const int width = std::min<int>(kMaxCellsPerSide,
+                                  floor(extent.x() / cell_size) + 1);
+  const int height = std::min<int>(kMaxCellsPerSide,
+                                   floor(extent.y() / cell_size) + 1);
+  vector<vector<int> > cells(width * height);
+  struct CellRange {
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+  };
+  const auto cell_range = [&](const Vector2f& p0,
+                              const Vector2f& p1,
+                              float margin) {
+    const Vector2f c0 = (p0.cwiseMin(p1) - bmin).array() - margin;
+    const Vector2f c1 = (p0.cwiseMax(p1) - bmin).array() + margin;
+    CellRange r;
+    r.x0 = std::max<int>(0, floor(c0.x() / cell_size));
+    r.y0 = std::max<int>(0, floor(c0.y() / cell_size));
+    r.x1 = std::min<int>(width - 1, floor(c1.x() / cell_size));
+    r.y1 = std::min<int>(height - 1, floor(c1.y() / cell_size));
+    return r;
+  };
+
   vector<Line2f> new_lines;
+  vector<int> candidates;
   for (size_t i = 0; i < lines.size(); ++i) {
     const Line2f l1 = lines[i];
     if (l1.Length() < kMinLineLength) continue;
     // Check if l1 intersects with any line in new lines.
+    const CellRange query = cell_range(l1.p0, l1.p1, kQueryMargin);
+    candidates.clear();
+    for (int y = query.y0; y <= query.y1; ++y) {
+      for (int x = query.x0; x <= query.x1; ++x) {
+        const vector<int>& cell = cells[y * width + x];
+        candidates.insert(candidates.end(), cell.begin(), cell.end());
+      }
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()),
+                     candidates.end());
     Vector2f p;
     bool intersection = false;
-    for (const Line2f l2 : new_lines) {
-      if (l2.Intersection(l1, &p)) {
+    for (const int j : candidates) {
+      if (new_lines[j].Intersection(l1, &p)) {
         const Vector2f shrink = kShrinkDistance * l1.Dir();
         lines.push_back(Line2f(l1.p0, p - shrink));
         lines.push_back(Line2f(p + shrink, l1.p1));
@@ -385,96 +455,809 @@ void VectorMap::Cleanup() {
       }
     }
     // No intersection, add it!
-    if (!intersection) new_lines.push_back(l1);
+    if (!intersection) {
+      const CellRange r = cell_range(l1.p0, l1.p1, 0);
+      for (int y = r.y0; y <= r.y1; ++y) {
+        for (int x = r.x0; x <= r.x1; ++x) {
+          cells[y * width + x].push_back(new_lines.size());
+        }
+      }
+      new_lines.push_back(l1);
+    }
   }
 
   for (Line2f& l : new_lines) {
     ShrinkLine(kShrinkDistance, &l);
   }
   lines = new_lines;
+  ++generation_;
 }
 
-void VectorMap::Load(const string& file) {
+bool VectorMap::Load(const string& file, bool persist) {
+  const double t_start = GetMonotonicTime();
+  uint64_t source_hash = 0;
   FILE* fid = fopen(file.c_str(), "r");
-  if (fid == NULL) {
+  if (fid == NULL || !HashFile(file, &source_hash)) {
     fprintf(stderr, "ERROR: Unable to load map %s\n", file.c_str());
-    exit(1);
+    if (fid != NULL) fclose(fid);
+    return false;
+  }
+  visibility_cache.Clear();
+  file_name = file;
+  // The old index and visibility cache are stale from here on, even if the
+  // map is loaded from the binary cache.
+  ++generation_;
+  // Reuse the cleaned up lines and index from the binary cache if they were
+  // computed from the same text map.
+  const string cache_file = MapSideFileName(file, ".map.bin");
+  if (persist && LoadMapCache(cache_file, source_hash, &lines, &line_grid)) {
+    index_generation_ = generation_;
+    fclose(fid);
+    printf("Loaded map %s from %s in %.3fs: %lu lines\n",
+           file.c_str(),
+           cache_file.c_str(),
+           GetMonotonicTime() - t_start,
+           lines.size());
+    return true;
   }
+
   lines.clear();
   float x1(0), y1(0), x2(0), y2(0);
   while (fscanf(fid, "%f,%f,%f,%f", &x1, &y1, &x2, &y2) == 4) {
     lines.push_back(Line2f(Vector2f(x1, y1), Vector2f(x2, y2)));
   }
   fclose(fid);
+  const size_t num_raw_lines = lines.size();
+  const double t_parse = GetMonotonicTime();
   Cleanup();
-  file_name = file;
+  const double t_cleanup = GetMonotonicTime();
+  BuildIndex();
+  const double t_index = GetMonotonicTime();
+  printf("Loaded map %s in %.3fs: parse %.3fs, cleanup %.3fs, index %.3fs, "
+         "%lu lines, %lu after cleanup\n",
+         file.c_str(),
+         t_index - t_start,
+         t_parse - t_start,
+         t_cleanup - t_parse,
+         t_index - t_cleanup,
+         num_raw_lines,
+         lines.size());
+  if (persist && !SaveMapCache(cache_file, source_hash, lines, line_grid)) {
+    fprintf(stderr, "WARNING: Unable to save map cache %s\n",
+            cache_file.c_str());
+  }
+  return true;
+}
+
+void VectorMap::BuildIndex() {
+  ++generation_;
+  line_grid.Build(lines, 0);
+  index_generation_ = generation_;
+}
+
+void VectorMap::BuildVisibilityCache(float cell_size, float max_range) {
+  const string cache_file = VisibilityCache::CacheFileName(file_name);
+  if (!file_name.empty() &&
+      visibility_cache.Load(cache_file, lines, cell_size, max_range)) {
+    visibility_generation_ = generation_;
+    return;
+  }
+  if (!IndexCurrent()) BuildIndex();
+  const double t_start = GetMonotonicTime();
+  visibility_cache.Build(lines, line_grid, cell_size, max_range);
+  visibility_generation_ = generation_;
+  printf("Computed visibility cache for %s in %.3fs\n",
+         file_name.c_str(), GetMonotonicTime() - t_start);
+  if (!file_name.empty() && !visibility_cache.Save(cache_file)) {
+    fprintf(stderr, "WARNING: Unable to save visibility cache %s\n",
+            cache_file.c_str());
+  }
 }
 
 bool VectorMap::Intersects(const Vector2f& v0, const Vector2f& v1) const {
-  for (const Line2f& l : lines) {
-    if (l.Intersects(v0, v1)) return true;
+  if (!IndexCurrent()) {
+    for (const Line2f& l : lines) {
+      if (l.Intersects(v0, v1)) return true;
+    }
+    return false;
+  }
+  vector<int> candidates;
+  line_grid.QueryBox(v0.cwiseMin(v1), v0.cwiseMax(v1), &candidates);
+  for (const int i : candidates) {
+    if (lines[i].Intersects(v0, v1)) return true;
   }
   return false;
 }
 
+ScanGeometry::ScanGeometry() :
+    angle_min_(0),
+    angle_max_(0),
+    angle_increment_(0) {}
+
+ScanGeometry::ScanGeometry(float angle_min, float angle_max, int num_rays) {
+  Set(angle_min, angle_max, num_rays);
+}
+
+void ScanGeometry::Set(float angle_min, float angle_max, int num_rays) {
+  angle_min_ = angle_min;
+  angle_max_ = angle_max;
+  angle_increment_ = (num_rays > 0) ?
+      (angle_max - angle_min) / static_cast<float>(num_rays) : 0;
+  rays_.resize(std::max(0, num_rays));
+  for (int i = 0; i < num_rays; ++i) {
+    const float a = angle_min_ + static_cast<float>(i) * angle_increment_;
+    rays_[i] = Vector2f(cos(a), sin(a));
+  }
+}
+
+void ScanGeometry::Rotate(float angle, vector<Vector2f>* rays_ptr) const {
+  vector<Vector2f>& rays = *rays_ptr;
+  const Eigen::Matrix2f rotation = Eigen::Rotation2Df(angle).matrix();
+  rays.resize(rays_.size());
+  for (size_t i = 0; i < rays_.size(); ++i) {
+    rays[i] = rotation * rays_[i];
+  }
+}
+
+namespace {
+// The part of the plane that a scanner can see: the points within range of
+// loc, at headings in [angle_min, angle_min + span]. The headings are padded
+// by a ray on either side, so that rounding never drops a line that a ray
+// hits.
+struct Sector {
+  Sector(const Vector2f& loc,
+         float range,
+         float angle,
+         const ScanGeometry& geometry) : loc(loc), range(range) {
+    const float pad = std::max<float>(geometry.AngleIncrement(), 1e-3);
+    angle_min = angle + geometry.AngleMin() - pad;
+    span = geometry.AngleMax() - geometry.AngleMin() + 2.0 * pad;
+    full = (span >= 2.0 * M_PI);
+    start_dir = Vector2f(cos(angle_min), sin(angle_min));
+    end_dir = Vector2f(cos(angle_min + span), sin(angle_min + span));
+  }
+
+  // Bounding box of the sector, which is smaller than the box around the
+  // circle of the range unless the sector covers all four axis directions.
+  void Box(Vector2f* box_min, Vector2f* box_max) const {
+    const Vector2f r(range, range);
+    if (full) {
+      *box_min = loc - r;
+      *box_max = loc + r;
+      return;
+    }
+    const Vector2f p0 = loc + range * Vector2f(cos(angle_min), sin(angle_min));
+    const Vector2f p1 = loc + range * Vector2f(cos(angle_min + span),
+                                               sin(angle_min + span));
+    *box_min = loc.cwiseMin(p0).cwiseMin(p1);
+    *box_max = loc.cwiseMax(p0).cwiseMax(p1);
+    const Vector2f axes[4] = {
+      Vector2f(1, 0), Vector2f(0, 1), Vector2f(-1, 0), Vector2f(0, -1)
+    };
+    for (int k = 0; k < 4; ++k) {
+      if (InSpan(0.5 * M_PI * k)) {
+        *box_min = box_min->cwiseMin(loc + range * axes[k]);
+        *box_max = box_max->cwiseMax(loc + range * axes[k]);
+      }
+    }
+  }
+
+  // True if heading a is within the headings of the sector.
+  bool InSpan(float a) const {
+    float rel = fmod(a - angle_min, static_cast<float>(2.0 * M_PI));
+    if (rel < 0.0) rel += 2.0 * M_PI;
+    return rel <= span;
+  }
+
+  // True if any point of l is in the sector.
+  bool Contains(const Line2f& l) const {
+    Vector2f p0 = l.p0 - loc;
+    Vector2f p1 = l.p1 - loc;
+    const Vector2f d = p1 - p0;
+    const float length_sq = d.squaredNorm();
+    const float t = (length_sq > 0.0) ?
+        std::max(0.0f, std::min(1.0f, -p0.dot(d) / length_sq)) : 0.0f;
+    if ((p0 + t * d).squaredNorm() > range * range) return false;
+    if (full) return true;
+    const float c = Cross(p0, p1);
+    // Lines through loc are seen at every heading.
+    if (c == 0.0 && p0.dot(p1) <= 0.0) return true;
+    if (c < 0.0) swap(p0, p1);
+    const float a0 = atan2(p0.y(), p0.x());
+    if (InSpan(a0)) return true;
+    // The line starts outside the sector, so it overlaps it iff it spans the
+    // start of the sector.
+    float line_span = atan2(p1.y(), p1.x()) - a0;
+    if (line_span < 0.0) line_span += 2.0 * M_PI;
+    float rel = fmod(angle_min - a0, static_cast<float>(2.0 * M_PI));
+    if (rel < 0.0) rel += 2.0 * M_PI;
+    return rel <= line_span;
+  }
+
+  // True if c may have points in the sector. Circles that are within range
+  // and within the headings of the sector, but not at the same points, are
+  // kept too. Uses no trigonometry, since it runs for every object near the
+  // sector.
+  bool Overlaps(const Circle& c) const {
+    const Vector2f p = c.center - loc;
+    const float d_sq = p.squaredNorm();
+    const float reach = range + c.radius;
+    if (d_sq > reach * reach) return false;
+    if (full || d_sq <= c.radius * c.radius) return true;
+    // The circle is within the headings if its center is, or if it reaches
+    // across either edge of the sector.
+    const bool after_start = (Cross(start_dir, p) >= 0.0);
+    const bool before_end = (Cross(p, end_dir) >= 0.0);
+    if (span <= M_PI ? (after_start && before_end) :
+                       (after_start || before_end)) {
+      return true;
+    }
+    return ((start_dir.dot(p) >= 0.0 &&
+             fabs(Cross(start_dir, p)) <= c.radius) ||
+            (end_dir.dot(p) >= 0.0 && fabs(Cross(end_dir, p)) <= c.radius));
+  }
+
+  Vector2f loc;
+  float range;
+  float angle_min;
+  float span;
+  bool full;
+  // Unit directions of the first and last headings of the sector.
+  Vector2f start_dir;
+  Vector2f end_dir;
+};
+
+// Remove the lines of lines_list that are outside sector.
+void CullToSector(const Sector& sector, vector<Line2f>* lines_list) {
+  lines_list->erase(std::remove_if(lines_list->begin(),
+                                   lines_list->end(),
+                                   [&](const Line2f& l) {
+                                     return !sector.Contains(l);
+                                   }),
+                    lines_list->end());
+}
+
+// Append the lines of object id that are in sector and overlap the box
+// [box_min, box_max] of the sector to lines, and its circles that overlap
+// the box to circles. Objects whose bounding circles miss the sector are
+// rejected before their shapes are transformed, which leaves out the same
+// lines as CullToSector.
+void AddObjectInSector(const ObjectIndex& index,
+                       int id,
+                       const Sector& sector,
+                       const Vector2f& box_min,
+                       const Vector2f& box_max,
+                       vector<Line2f>* lines,
+                       vector<Circle>* circles) {
+  if (!sector.Overlaps(index.Bounds(id))) return;
+  const ShapeView view = index.View(id);
+  for (int k = 0; k < view.NumLines(); ++k) {
+    const Line2f l = view.Line(k);
+    if (InBox(l, box_min, box_max) && sector.Contains(l)) lines->push_back(l);
+  }
+  for (int k = 0; k < view.NumCircles(); ++k) {
+    const Circle c = view.GetCircle(k);
+    if (c.InBox(box_min, box_max)) circles->push_back(c);
+  }
+}
+
+// Append the object lines and circles other than those of ignore_object that
+// are in sector, whose bounding box is [box_min, box_max], like
+// AddObjectInSector.
+void GetObjectsInSector(const ObjectIndex& index,
+                        const Sector& sector,
+                        const Vector2f& box_min,
+                        const Vector2f& box_max,
+                        int ignore_object,
+                        vector<Line2f>* lines,
+                        vector<Circle>* circles) {
+  index.Query(box_min, box_max, [&](int id) {
+    if (id == ignore_object) return;
+    AddObjectInSector(index, id, sector, box_min, box_max, lines, circles);
+  });
+}
+
+// Get the rays of a scanner, with rays starting at heading angle_min and
+// increment da, that may hit the line from r0 to r1 relative to the scanner,
+// as fractional ray indices [i0, i1], padded by a ray on either side.
+// Returns false, leaving i0 and i1 unchanged, for lines through the scanner,
+// which may be hit at any heading.
+bool LineRays(Vector2f r0,
+              Vector2f r1,
+              float angle_min,
+              float da,
+              float* i0,
+              float* i1) {
+  const float c = Cross(r0, r1);
+  if (c == 0.0 && r0.dot(r1) <= 0.0) return false;
+  if (c < 0.0) swap(r0, r1);
+  const float a0 = atan2(r0.y(), r0.x());
+  float span = atan2(r1.y(), r1.x()) - a0;
+  if (span < 0.0) span += 2.0 * M_PI;
+  float rel = fmod(a0 - angle_min, static_cast<float>(2.0 * M_PI));
+  if (rel < 0.0) rel += 2.0 * M_PI;
+  *i0 = rel / da - 1.0;
+  *i1 = (rel + span) / da + 1.0;
+  return true;
+}
+
+// Call hit(i) for each ray i of the scanner with geometry within the
+// fractional ray indices [i0, i1]. The ray angles repeat every revolution, so
+// the rays within the interval shifted by one revolution either way are
+// included too.
+template <typename Hit>
+void ForEachRay(const ScanGeometry& geometry, float i0, float i1, Hit hit) {
+  const int num_rays = geometry.NumRays();
+  const float da = geometry.AngleIncrement();
+  // Scanners with no angular extent have all rays along the same direction.
+  const bool sweeps = (da > 0.0);
+  const float rays_per_rev = sweeps ? 2.0 * M_PI / da : 0.0;
+  const int num_shifts = sweeps ? 1 : 0;
+  for (int k = -num_shifts; k <= num_shifts; ++k) {
+    const int first = std::max<int>(0, floor(i0 + k * rays_per_rev));
+    const int last = std::min<int>(num_rays - 1,
+                                   ceil(i1 + k * rays_per_rev));
+    for (int i = first; i <= last; ++i) hit(i);
+  }
+}
+
+// Lower the ranges in scan to the hits on lines, with rays already rotated
+// to the heading angle of the scanner. Each line is intersected with each
+// ray within its angular extent, so unlike the sweep, lines may cross.
+void ScanLines(const Vector2f& loc,
+               float angle,
+               const ScanGeometry& geometry,
+               const vector<Line2f>& lines,
+               const vector<Vector2f>& rays,
+               float* scan) {
+  const float angle_min = angle + geometry.AngleMin();
+  const float da = geometry.AngleIncrement();
+  for (const Line2f& l : lines) {
+    const Vector2f p0 = l.p0 - loc;
+    const Vector2f p1 = l.p1 - loc;
+    const Vector2f e = p1 - p0;
+    const float cross_p0_e = Cross(p0, e);
+    float i0 = 0;
+    float i1 = geometry.NumRays() - 1;
+    if (da > 0.0) LineRays(p0, p1, angle_min, da, &i0, &i1);
+    ForEachRay(geometry, i0, i1, [&](int i) {
+      const Vector2f& r = rays[i];
+      const float denom = Cross(r, e);
+      if (denom == 0.0) return;
+      const float t = cross_p0_e / denom;
+      const float u = Cross(p0, r) / denom;
+      if (t > 0.0 && u >= 0.0 && u <= 1.0 && t < scan[i]) scan[i] = t;
+    });
+  }
+}
+
+// Lower the ranges in scan to the hits on circles, with rays already rotated
+// to the heading angle of the scanner. Each circle is only intersected with
+// the rays within its angular extent, padded by a ray on either side.
+void ScanCircles(const Vector2f& loc,
+                 float angle,
+                 const ScanGeometry& geometry,
+                 const vector<Circle>& circles,
+                 const vector<Vector2f>& rays,
+                 float* scan) {
+  const float angle_min = angle + geometry.AngleMin();
+  const float da = geometry.AngleIncrement();
+  for (const Circle& c : circles) {
+    const Vector2f p = c.center - loc;
+    const float d = p.norm();
+    // Rays from inside a circle do not hit it.
+    if (d <= c.radius) continue;
+    float i0 = 0;
+    float i1 = geometry.NumRays() - 1;
+    if (da > 0.0) {
+      const float half_span = asin(c.radius / d);
+      float rel = fmod(atan2(p.y(), p.x()) - angle_min,
+                       static_cast<float>(2.0 * M_PI));
+      if (rel < 0.0) rel += 2.0 * M_PI;
+      i0 = (rel - half_span) / da - 1.0;
+      i1 = (rel + half_span) / da + 1.0;
+    }
+    ForEachRay(geometry, i0, i1, [&](int i) {
+      const float t = c.Intersect(loc, rays[i]);
+      if (t > 0.0 && t < scan[i]) scan[i] = t;
+    });
+  }
+}
+}  // namespace
+
 void VectorMap::GetPredictedScan(const Vector2f& loc,
                                  float range_min,
                                  float range_max,
                                  float angle_min,
                                  float angle_max,
                                  int num_rays,
-                                 vector<float>* scan_ptr) {
-  static CumulativeFunctionTimer function_timer_(__FUNCTION__);
-  CumulativeFunctionTimer::Invocation invoke(&function_timer_);
-  vector<float>& scan = *scan_ptr;
-  vector<Line2f> raycast;
-  SceneRender(loc, range_max, angle_min, angle_max, &raycast);
-  scan.resize(num_rays);
-  std::fill(scan.begin(), scan.end(), range_max);
-  if (raycast.empty()) {
-    return;
+                                 vector<float>* scan_ptr) const {
+  ScanWorkspace workspace;
+  GetPredictedScan(loc,
+                   range_max,
+                   0,
+                   ScanGeometry(angle_min, angle_max, num_rays),
+                   -1,
+                   &workspace,
+                   scan_ptr);
+}
+
+void VectorMap::GetPredictedScanSimd(const Vector2f& loc,
+                                     float range_min,
+                                     float range_max,
+                                     float angle_min,
+                                     float angle_max,
+                                     int num_rays,
+                                     vector<float>* scan_ptr) const {
+  ScanWorkspace workspace;
+  GetPredictedScanSimd(loc,
+                       range_max,
+                       0,
+                       ScanGeometry(angle_min, angle_max, num_rays),
+                       -1,
+                       &workspace,
+                       scan_ptr);
+}
+
+void VectorMap::GetPredictedScan(const Vector2f& loc,
+                                 float range_max,
+                                 float angle,
+                                 const ScanGeometry& geometry,
+                                 int ignore_object,
+                                 ScanWorkspace* workspace,
+                                 vector<float>* scan_ptr) const {
+  static AllocationCounter allocation_counter_(__FUNCTION__);
+  AllocationCounter::Invocation count(&allocation_counter_, workspace);
+  const Sector sector(loc, range_max, angle, geometry);
+  Vector2f box_min, box_max;
+  sector.Box(&box_min, &box_max);
+  GetMapLinesInBox(loc,
+                   range_max,
+                   box_min,
+                   box_max,
+                   &workspace->candidates,
+                   &workspace->scene_lines);
+  CullToSector(sector, &workspace->scene_lines);
+  workspace->object_lines.clear();
+  workspace->scene_circles.clear();
+  GetObjectsInSector(object_index,
+                     sector,
+                     box_min,
+                     box_max,
+                     ignore_object,
+                     &workspace->object_lines,
+                     &workspace->scene_circles);
+  scan_ptr->resize(geometry.NumRays());
+  ScanSceneLines(loc, range_max, angle, geometry, workspace, scan_ptr->data());
+}
+
+void VectorMap::GetPredictedScans(const vector<Vector2f>& locs,
+                                  const vector<float>& angles,
+                                  float range_max,
+                                  const ScanGeometry& geometry,
+                                  int ignore_object,
+                                  BatchScanWorkspace* workspace,
+                                  vector<float>* scans) const {
+  // Side of the cells of the grid that groups nearby poses. Larger cells
+  // share the line queries between more poses, but leave more lines out of
+  // range of each pose to filter out.
+  static const float kGroupCellSize = 1.0;
+  const int num_poses = static_cast<int>(std::min(locs.size(), angles.size()));
+  const int num_rays = geometry.NumRays();
+  scans->resize(static_cast<size_t>(num_poses) * num_rays);
+  if (num_poses == 0 || num_rays == 0) return;
+  // The potentially visible sets are already shared by all poses in a cell,
+  // and are smaller than the lines in range of a group, so they are used
+  // directly when available.
+  const bool share_lines = !(VisibilityCacheCurrent() &&
+                             range_max <= visibility_cache.MaxRange());
+
+  // Sort the poses by the cell they fall in, so that each group of poses in
+  // the same cell is contiguous.
+  vector<std::pair<uint64_t, int> >& order = workspace->order;
+  order.resize(num_poses);
+  for (int i = 0; i < num_poses; ++i) {
+    const int64_t x = floor(locs[i].x() / kGroupCellSize);
+    const int64_t y = floor(locs[i].y() / kGroupCellSize);
+    const uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(x)) <<
+                          32) | static_cast<uint32_t>(y);
+    order[i] = std::make_pair(key, i);
   }
-  struct LineCast {
-    Line2f line;
-    float a0;
-    float a1;
-    bool wraps_around;
-  };
-  vector<LineCast> line_cast;
-  for (size_t i = 0; i < raycast.size(); ++i) {
-    const Line2f& r = raycast[i];
-    LineCast l;
-    l.line.p0 = r.p0 - loc;
-    l.line.p1 = r.p1 - loc;
-    l.a0 = atan2(l.line.p0.y(), l.line.p0.x());
-    l.a1 = atan2(l.line.p1.y(), l.line.p1.x());
-    if (fabs(l.a0 - l.a1) < 0.0001) continue;
-    l.wraps_around = fabs(l.a1 - l.a0) > M_PI;
-    if ((l.wraps_around && l.a0 < l.a1) ||
-        (!l.wraps_around && l.a0 > l.a1)) {
-      swap(l.a0, l.a1);
-      swap(l.line.p0, l.line.p1);
+  std::sort(order.begin(), order.end());
+  vector<int>& group_start = workspace->group_start;
+  group_start.clear();
+  for (int i = 0; i < num_poses; ++i) {
+    if (i == 0 || order[i].first != order[i - 1].first) {
+      group_start.push_back(i);
+    }
+  }
+  group_start.push_back(num_poses);
+  const int num_groups = static_cast<int>(group_start.size()) - 1;
+
+#ifdef _OPENMP
+  const size_t num_threads = omp_get_max_threads();
+#else
+  const size_t num_threads = 1;
+#endif
+  while (workspace->threads.size() < num_threads) {
+    workspace->threads.emplace_back(new BatchScanWorkspace::Thread());
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(dynamic)
+#endif
+  for (int g = 0; g < num_groups; ++g) {
+#ifdef _OPENMP
+    BatchScanWorkspace::Thread& thread =
+        *workspace->threads[omp_get_thread_num()];
+#else
+    BatchScanWorkspace::Thread& thread = *workspace->threads[0];
+#endif
+    ScanWorkspace& scan_workspace = thread.scan;
+    const int begin = group_start[g];
+    const int end = group_start[g + 1];
+    if (share_lines) {
+      // Gather the lines in the sectors seen from any pose of the group once.
+      Vector2f group_min, group_max;
+      for (int k = begin; k < end; ++k) {
+        const int i = order[k].second;
+        Vector2f box_min, box_max;
+        Sector(locs[i], range_max, angles[i], geometry).Box(&box_min,
+                                                            &box_max);
+        group_min = (k == begin) ? box_min : group_min.cwiseMin(box_min);
+        group_max = (k == begin) ? box_max : group_max.cwiseMax(box_max);
+      }
+      GetGridLinesInBox(group_min,
+                        group_max,
+                        &scan_workspace.candidates,
+                        &thread.group_lines);
+      thread.group_objects.clear();
+      object_index.Query(group_min, group_max, [&](int id) {
+        if (id != ignore_object) thread.group_objects.push_back(id);
+      });
+    }
+    for (int k = begin; k < end; ++k) {
+      const int i = order[k].second;
+      const Vector2f& loc = locs[i];
+      const Sector sector(loc, range_max, angles[i], geometry);
+      Vector2f box_min, box_max;
+      sector.Box(&box_min, &box_max);
+      if (share_lines) {
+        vector<Line2f>& scene_lines = scan_workspace.scene_lines;
+        scene_lines.clear();
+        for (const Line2f& l : thread.group_lines) {
+          if (InBox(l, box_min, box_max) && sector.Contains(l)) {
+            scene_lines.push_back(l);
+          }
+        }
+        scan_workspace.object_lines.clear();
+        scan_workspace.scene_circles.clear();
+        for (const int id : thread.group_objects) {
+          AddObjectInSector(object_index,
+                            id,
+                            sector,
+                            box_min,
+                            box_max,
+                            &scan_workspace.object_lines,
+                            &scan_workspace.scene_circles);
+        }
+      } else {
+        GetMapLinesInBox(loc,
+                         range_max,
+                         box_min,
+                         box_max,
+                         &scan_workspace.candidates,
+                         &scan_workspace.scene_lines);
+        CullToSector(sector, &scan_workspace.scene_lines);
+        scan_workspace.object_lines.clear();
+        scan_workspace.scene_circles.clear();
+        GetObjectsInSector(object_index,
+                           sector,
+                           box_min,
+                           box_max,
+                           ignore_object,
+                           &scan_workspace.object_lines,
+                           &scan_workspace.scene_circles);
+      }
+      ScanSceneLines(loc,
+                     range_max,
+                     angles[i],
+                     geometry,
+                     &scan_workspace,
+                     scans->data() + static_cast<size_t>(i) * num_rays);
     }
+  }
+}
+
+void VectorMap::ScanSceneLines(const Vector2f& loc,
+                               float range_max,
+                               float angle,
+                               const ScanGeometry& geometry,
+                               ScanWorkspace* workspace,
+                               float* scan) const {
+  vector<Line2f>& raycast = workspace->visible;
+  VisibleSegments(
+      loc, workspace->scene_lines, &workspace->sweep, &raycast, nullptr);
+  const int num_rays = geometry.NumRays();
+  // Rays that miss all lines are set to range_max once the object lines are
+  // cast too.
+  const float kNoHit = std::numeric_limits<float>::infinity();
+  std::fill(scan, scan + num_rays, kNoHit);
+  // The visible segments relative to loc, with their endpoints in
+  // counter-clockwise order. A segment that does not contain loc spans less
+  // than half a revolution, so the ray with direction d hits it iff
+  // Cross(p0, d) >= 0 and Cross(d, p1) >= 0, and no angles are needed.
+  vector<LineCast>& line_cast = workspace->line_cast;
+  line_cast.clear();
+  for (const Line2f& r : raycast) {
+    LineCast l;
+    l.p0 = r.p0 - loc;
+    l.p1 = r.p1 - loc;
+    const float c = Cross(l.p0, l.p1);
+    if (c == 0.0) continue;
+    if (c < 0.0) swap(l.p0, l.p1);
+    l.dir = l.p1 - l.p0;
+    l.cross_p0_dir = Cross(l.p0, l.dir);
     line_cast.push_back(l);
   }
-  if (line_cast.empty()) {
+  const vector<Line2f>& object_lines = workspace->object_lines;
+  const vector<Circle>& circles = workspace->scene_circles;
+  if (line_cast.empty() && object_lines.empty() && circles.empty()) {
+    std::fill(scan, scan + num_rays, range_max);
     return;
   }
-  // Iterate over the ray cast, filling the angles
-  scan.resize(num_rays);
-  const float da = (angle_max - angle_min) / static_cast<float>(num_rays);
+  vector<Vector2f>& rays = workspace->rays;
+  geometry.Rotate(angle, &rays);
+  const size_t num_lines = line_cast.size();
+  // Consecutive rays mostly hit the same segment, so the search for each ray
+  // starts at the segment hit by the previous one.
+  size_t hint = 0;
   for (int i = 0; i < num_rays; ++i) {
-    const float a = AngleMod(angle_min + static_cast<float>(i) * da);
-    for (const LineCast& l : line_cast) {
-      if ((!l.wraps_around && l.a0 <= a && l.a1 >= a) ||
-          (l.wraps_around && (l.a0 <= a || l.a1 >= a))) {
-        const Vector2f n = l.line.UnitNormal();
-        const Vector2f r(cos(a), sin(a));
-        scan[i] = n.dot(l.line.p0) / n.dot(r);
+    const Vector2f& r = rays[i];
+    for (size_t k = 0; k < num_lines; ++k) {
+      const size_t j = (hint + k < num_lines) ? hint + k : hint + k - num_lines;
+      const LineCast& l = line_cast[j];
+      if (Cross(l.p0, r) >= 0.0 && Cross(r, l.p1) >= 0.0) {
+        scan[i] = l.cross_p0_dir / Cross(r, l.dir);
+        hint = j;
         break;
       }
     }
   }
+  ScanLines(loc, angle, geometry, object_lines, rays, scan);
+  for (int i = 0; i < num_rays; ++i) {
+    if (scan[i] == kNoHit) scan[i] = range_max;
+  }
+  ScanCircles(loc, angle, geometry, circles, rays, scan);
+}
+
+void VectorMap::GetPredictedScanSimd(const Vector2f& loc,
+                                     float range_max,
+                                     float angle,
+                                     const ScanGeometry& geometry,
+                                     int ignore_object,
+                                     ScanWorkspace* workspace,
+                                     vector<float>* scan_ptr) const {
+  static AllocationCounter allocation_counter_(__FUNCTION__);
+  AllocationCounter::Invocation count(&allocation_counter_, workspace);
+  const int num_rays = geometry.NumRays();
+  const float angle_min = angle + geometry.AngleMin();
+  vector<float>& scan = *scan_ptr;
+  scan.resize(num_rays);
+  std::fill(scan.begin(), scan.end(), range_max);
+  const Sector sector(loc, range_max, angle, geometry);
+  Vector2f box_min, box_max;
+  sector.Box(&box_min, &box_max);
+  vector<Line2f>& lines_list = workspace->scene_lines;
+  GetMapLinesInBox(loc,
+                   range_max,
+                   box_min,
+                   box_max,
+                   &workspace->candidates,
+                   &lines_list);
+  CullToSector(sector, &lines_list);
+  vector<Circle>& circles = workspace->scene_circles;
+  circles.clear();
+  GetObjectsInSector(object_index,
+                     sector,
+                     box_min,
+                     box_max,
+                     ignore_object,
+                     &lines_list,
+                     &circles);
+  if (num_rays < 1) return;
+  vector<Vector2f>& rays = workspace->rays;
+  geometry.Rotate(angle, &rays);
+  if (lines_list.empty()) {
+    ScanCircles(loc, angle, geometry, circles, rays, scan.data());
+    return;
+  }
+  LineSoA& soa = workspace->soa;
+  soa.Clear();
+  for (const Line2f& l : lines_list) {
+    soa.Add(l, loc);
+  }
+
+  // Pad the rays to a whole number of packets.
+  const int packet = RayPacketSize();
+  const int num_packets = (num_rays + packet - 1) / packet;
+  const int num_padded = num_packets * packet;
+  vector<float>& ray_x = workspace->ray_x;
+  vector<float>& ray_y = workspace->ray_y;
+  ray_x.assign(num_padded, 1);
+  ray_y.assign(num_padded, 0);
+  // Like GetPredictedScan, report hits on any line in the scene, even if
+  // they are beyond range_max, and only fall back to range_max for misses.
+  const float kNoHit = std::numeric_limits<float>::infinity();
+  vector<float>& ranges = workspace->ranges;
+  ranges.assign(num_padded, kNoHit);
+  for (int i = 0; i < num_rays; ++i) {
+    ray_x[i] = rays[i].x();
+    ray_y[i] = rays[i].y();
+  }
+  const float da = geometry.AngleIncrement();
+
+  // Bin the lines by the packets of rays that fall within their angular
+  // extent, so that each packet is only tested against the lines it can hit.
+  // The extents are padded by a ray on either side to be conservative.
+  vector<RayInterval>& intervals = workspace->intervals;
+  intervals.clear();
+  // Scanners with no angular extent have all rays along the same direction,
+  // so every line is binned to all packets.
+  const bool sweeps = (da > 0.0);
+  const float rays_per_rev = sweeps ? 2.0 * M_PI / da : 0.0;
+  const int num_shifts = sweeps ? 1 : 0;
+  for (size_t j = 0; j < lines_list.size(); ++j) {
+    Vector2f r0(soa.x0[j], soa.y0[j]);
+    Vector2f r1(soa.x0[j] + soa.dx[j], soa.y0[j] + soa.dy[j]);
+    float i0 = 0;
+    float i1 = num_padded;
+    if (sweeps) LineRays(r0, r1, angle_min, da, &i0, &i1);
+    // The ray angles repeat every revolution, so also check the interval
+    // shifted by one revolution either way.
+    for (int k = -num_shifts; k <= num_shifts; ++k) {
+      const int first = std::max<int>(0, floor(i0 + k * rays_per_rev));
+      const int last = std::min<int>(num_padded - 1,
+                                     ceil(i1 + k * rays_per_rev));
+      if (first > last) continue;
+      RayInterval interval;
+      interval.line = j;
+      interval.p0 = first / packet;
+      interval.p1 = last / packet;
+      intervals.push_back(interval);
+    }
+  }
+  vector<int>& packet_start = workspace->packet_start;
+  packet_start.assign(num_packets + 1, 0);
+  for (const RayInterval& r : intervals) {
+    for (int p = r.p0; p <= r.p1; ++p) ++packet_start[p + 1];
+  }
+  for (int p = 0; p < num_packets; ++p) {
+    packet_start[p + 1] += packet_start[p];
+  }
+  vector<int>& packet_lines = workspace->packet_lines;
+  vector<int>& fill = workspace->packet_fill;
+  packet_lines.resize(packet_start.back());
+  fill.assign(packet_start.begin(), packet_start.end() - 1);
+  for (const RayInterval& r : intervals) {
+    for (int p = r.p0; p <= r.p1; ++p) packet_lines[fill[p]++] = r.line;
+  }
+
+  for (int p = 0; p < num_packets; ++p) {
+    const int n = packet_start[p + 1] - packet_start[p];
+    if (n == 0) continue;
+    const int i = p * packet;
+    IntersectRayPacket(soa,
+                       packet_lines.data() + packet_start[p],
+                       n,
+                       ray_x.data() + i,
+                       ray_y.data() + i,
+                       ranges.data() + i);
+  }
+  for (int i = 0; i < num_rays; ++i) {
+    if (ranges[i] < kNoHit) scan[i] = ranges[i];
+  }
+  ScanCircles(loc, angle, geometry, circles, rays, scan.data());
 }
 
 }  // namespace vector_map
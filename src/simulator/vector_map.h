@@ -19,67 +19,282 @@
 */
 //========================================================================
 
+#include <stdint.h>
+#include <stdlib.h>
+
 #include <string>
 #include <vector>
 
 #include "eigen3/Eigen/Dense"
 #include "math/line2d.h"
+#include "circle.h"
 #include "entity_base.h"
+#include "line_grid.h"
+#include "object_index.h"
+#include "ray_kernels.h"
+#include "scan_workspace.h"
+#include "visibility_cache.h"
 
 #ifndef VECTOR_MAP_H
 #define VECTOR_MAP_H
 
 namespace vector_map {
 
-// Checks if any part of trim_line is occluded by test_line when seen from
-// loc, and if so, trim_line is trimmed accordingly, adding sub-lines to
-// scene_lines if necessary.
-void TrimOcclusion(const Eigen::Vector2f& loc,
-                  const geometry::Line2f& line1,
-                  geometry::Line2f* line2_ptr,
-                  std::vector<geometry::Line2f>* scene_lines_ptr);
+// Splits lines at the points where they cross each other, so that no two of
+// them cross. The lines before first must not cross each other, like the
+// lines of a cleaned up map, so only the pairs with at least one line from
+// first on are tested, in O(n * (n - first)) time. The parts after a split
+// are appended to lines.
+void SplitCrossings(size_t first, std::vector<geometry::Line2f>* lines);
+
+// Computes the parts of lines that are visible from loc, with an angular
+// sweep over the line endpoints that keeps the lines crossing the sweep ray
+// in an ordered set, in O(n log n) time. Lines must not cross each other,
+// since the order of the set is only valid for lines that do not, so lines
+// that may cross must be split with SplitCrossings first. If line_ids is not
+// null, it is filled with the index in lines of the line that each visible
+// segment belongs to.
+void VisibleSegments(const Eigen::Vector2f& loc,
+                     const std::vector<geometry::Line2f>& lines,
+                     std::vector<geometry::Line2f>* visible,
+                     std::vector<int>* line_ids);
+
+// Same as above, using the buffers in workspace instead of allocating them.
+void VisibleSegments(const Eigen::Vector2f& loc,
+                     const std::vector<geometry::Line2f>& lines,
+                     SweepWorkspace* workspace,
+                     std::vector<geometry::Line2f>* visible,
+                     std::vector<int>* line_ids);
+
+// Unit directions of the rays of a laser scanner, relative to its heading.
+// The directions only depend on the scanner parameters, so they are computed
+// once per scanner, and each scan only needs to rotate them.
+class ScanGeometry {
+ public:
+  ScanGeometry();
+  ScanGeometry(float angle_min, float angle_max, int num_rays);
+
+  // Set the scanner parameters. Ray i is at angle
+  // angle_min + i * (angle_max - angle_min) / num_rays.
+  void Set(float angle_min, float angle_max, int num_rays);
+
+  // Get the ray directions of the scanner when its heading is angle.
+  void Rotate(float angle, std::vector<Eigen::Vector2f>* rays) const;
+
+  int NumRays() const { return static_cast<int>(rays_.size()); }
+  float AngleMin() const { return angle_min_; }
+  float AngleMax() const { return angle_max_; }
+  float AngleIncrement() const { return angle_increment_; }
+
+ private:
+  float angle_min_;
+  float angle_max_;
+  float angle_increment_;
+  std::vector<Eigen::Vector2f> rays_;
+};
 
 struct VectorMap {
-  VectorMap() {}
+  VectorMap() :
+      generation_(1), index_generation_(0), visibility_generation_(0) {}
   explicit VectorMap(const std::vector<geometry::Line2f>& lines) :
-      lines(lines) {}
-  explicit VectorMap(const std::string& file) {
-    Load(file);
+      lines(lines),
+      generation_(1),
+      index_generation_(0),
+      visibility_generation_(0) {
+    BuildIndex();
   }
+  explicit VectorMap(const std::string& file) :
+      generation_(1), index_generation_(0), visibility_generation_(0) {
+    if (!Load(file, false)) exit(1);
+  }
+
+  void GetSceneLines(const Eigen::Vector2f& loc,
+                     float max_range,
+                     std::vector<geometry::Line2f>* lines_list) const;
 
+  // Same as above, with a buffer for the candidate line indices, leaving out
+  // the lines of object ignore_object, such as the robot carrying the
+  // sensor. Pass -1 to include all objects.
   void GetSceneLines(const Eigen::Vector2f& loc,
                      float max_range,
+                     int ignore_object,
+                     std::vector<int>* candidates,
                      std::vector<geometry::Line2f>* lines_list) const;
 
+  // Get the map lines, without object lines, whose bounding boxes overlap
+  // the box [box_min, box_max], which must be within max_range of loc. The
+  // potentially visible set of loc is used if it covers max_range.
+  void GetMapLinesInBox(const Eigen::Vector2f& loc,
+                        float max_range,
+                        const Eigen::Vector2f& box_min,
+                        const Eigen::Vector2f& box_max,
+                        std::vector<int>* candidates,
+                        std::vector<geometry::Line2f>* lines_list) const;
+
+  // Get the map lines, without object lines, whose bounding boxes overlap
+  // the box [box_min, box_max], from the spatial index.
+  void GetGridLinesInBox(const Eigen::Vector2f& box_min,
+                         const Eigen::Vector2f& box_max,
+                         std::vector<int>* candidates,
+                         std::vector<geometry::Line2f>* lines_list) const;
+
+  // Same as GetSceneLines, only including the lines whose bounding boxes
+  // overlap the box [box_min, box_max], which must be within max_range of
+  // loc. The map lines come first, followed by the object lines.
+  void GetSceneLinesInBox(const Eigen::Vector2f& loc,
+                          float max_range,
+                          const Eigen::Vector2f& box_min,
+                          const Eigen::Vector2f& box_max,
+                          int ignore_object,
+                          std::vector<int>* candidates,
+                          std::vector<geometry::Line2f>* lines_list) const;
+
+  // Get all lines, including object lines other than those of
+  // ignore_object, whose bounding boxes overlap the box [box_min, box_max].
+  void GetLinesInBox(const Eigen::Vector2f& box_min,
+                     const Eigen::Vector2f& box_max,
+                     int ignore_object,
+                     std::vector<int>* candidates,
+                     std::vector<geometry::Line2f>* lines_list) const;
 
-  void SceneRender(const Eigen::Vector2f& loc,
-                   float max_range,
-                   float angle_min,
-                   float angle_max,
-                   std::vector<geometry::Line2f>* render) const;
+  // Append the object lines other than those of ignore_object whose
+  // bounding boxes overlap the box [box_min, box_max].
+  void GetObjectLinesInBox(const Eigen::Vector2f& box_min,
+                           const Eigen::Vector2f& box_max,
+                           int ignore_object,
+                           std::vector<geometry::Line2f>* lines_list) const;
 
+  // Get the object circles other than those of ignore_object whose bounding
+  // boxes overlap the box [box_min, box_max].
+  void GetObjectCirclesInBox(const Eigen::Vector2f& box_min,
+                             const Eigen::Vector2f& box_max,
+                             int ignore_object,
+                             std::vector<Circle>* circles) const;
+
+  // Get the visible parts of all lines within max_range of loc.
   void RayCast(const Eigen::Vector2f& loc,
                float max_range,
                std::vector<geometry::Line2f>* render) const;
 
-  // Get predicted laser scan from current location.
+  // Get predicted laser scan from loc, for a scanner with the given ray
+  // geometry and heading angle, using the buffers in workspace. The lines of
+  // object ignore_object, such as the robot carrying the sensor, are left
+  // out, as are the lines outside the sector that the rays sweep within
+  // range_max, which no ray can hit within range. Only reads the map, so
+  // scans may be computed concurrently from multiple threads, each with its
+  // own workspace.
+  void GetPredictedScan(const Eigen::Vector2f& loc,
+                        float range_max,
+                        float angle,
+                        const ScanGeometry& geometry,
+                        int ignore_object,
+                        ScanWorkspace* workspace,
+                        std::vector<float>* scan) const;
+
+  // Get predicted laser scans from each of the sensor locations locs[i] with
+  // heading angles[i], for a scanner with the given ray geometry. The ranges
+  // of scan i are written to scans[i * num_rays, (i + 1) * num_rays). Nearby
+  // poses share a single query for the lines in range, and groups of poses
+  // are simulated in parallel with the buffers in workspace.
+  void GetPredictedScans(const std::vector<Eigen::Vector2f>& locs,
+                         const std::vector<float>& angles,
+                         float range_max,
+                         const ScanGeometry& geometry,
+                         int ignore_object,
+                         BatchScanWorkspace* workspace,
+                         std::vector<float>* scans) const;
+
+  // Get predicted laser scan from loc against the map lines in
+  // workspace->scene_lines, the object lines in workspace->object_lines and
+  // the circles in workspace->scene_circles, writing geometry.NumRays()
+  // ranges to scan. Object lines may cross map lines and each other, so only
+  // the map lines are swept, and the object lines are intersected with each
+  // ray in their angular extent.
+  void ScanSceneLines(const Eigen::Vector2f& loc,
+                      float range_max,
+                      float angle,
+                      const ScanGeometry& geometry,
+                      ScanWorkspace* workspace,
+                      float* scan) const;
+
+  // Same as GetPredictedScan, by intersecting packets of rays against all
+  // lines in range with SIMD kernels, instead of rendering the visible scene
+  // first. Returns the same ranges, up to floating point tolerance.
+  void GetPredictedScanSimd(const Eigen::Vector2f& loc,
+                            float range_max,
+                            float angle,
+                            const ScanGeometry& geometry,
+                            int ignore_object,
+                            ScanWorkspace* workspace,
+                            std::vector<float>* scan) const;
+
+  // Get predicted laser scan from current location, with ray directions and
+  // buffers allocated for this scan only.
   void GetPredictedScan(const Eigen::Vector2f& loc,
                         float range_min,
                         float range_max,
                         float angle_min,
                         float angle_max,
                         int num_rays,
-                        std::vector<float>* scan);
+                        std::vector<float>* scan) const;
+
+  void GetPredictedScanSimd(const Eigen::Vector2f& loc,
+                            float range_min,
+                            float range_max,
+                            float angle_min,
+                            float angle_max,
+                            int num_rays,
+                            std::vector<float>* scan) const;
   void Cleanup();
 
-  void Load(const std::string& file);
+  // Load the map from file. Returns false, leaving the map unchanged, if the
+  // file cannot be read. If persist is set, the cleaned up lines and their
+  // index are loaded from, or else saved to, <file>.map.bin next to it.
+  bool Load(const std::string& file, bool persist);
+
+  // Rebuild the spatial index over lines. Must be called after lines is
+  // modified, which also invalidates the visibility cache; until then,
+  // queries fall back to a linear scan.
+  void BuildIndex();
+
+  // Generation of lines, which changes whenever they are loaded, cleaned up
+  // or reindexed, so that indices built over other lines are not used.
+  uint64_t Generation() const { return generation_; }
+
+  // True if line_grid was built over the current lines.
+  bool IndexCurrent() const { return index_generation_ == generation_; }
+
+  // True if visibility_cache was built over the current lines.
+  bool VisibilityCacheCurrent() const {
+    return visibility_generation_ == generation_;
+  }
+
+  // Precompute the potentially visible lines from each cell of a grid with
+  // cells of side cell_size, for sensors of range up to max_range. The cache
+  // is loaded from the file next to the map file if it matches, and saved
+  // there otherwise.
+  void BuildVisibilityCache(float cell_size, float max_range);
 
   bool Intersects(const Eigen::Vector2f& v0, const Eigen::Vector2f& v1) const ;
   std::vector<geometry::Line2f> lines;
 
-  // for all kinds of obstacles
-  std::vector<geometry::Line2f> object_lines;
+  // Spatial index over lines.
+  LineGrid line_grid;
+
+  // Optional potentially visible sets of lines.
+  VisibilityCache visibility_cache;
+
+  // Lines and circles of all kinds of obstacles, keyed by object id.
+  ObjectIndex object_index;
   std::string file_name;
+
+ private:
+  // Generations of lines, and of the lines that line_grid and
+  // visibility_cache were built over. Neither is built over the lines of a
+  // new map, which start at generation 1.
+  uint64_t generation_;
+  uint64_t index_generation_;
+  uint64_t visibility_generation_;
 };
 
 
@@ -0,0 +1,300 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    visibility_cache.cpp
+\brief   Precomputed potentially visible sets of static map lines.
+*/
+//========================================================================
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+
+#include "shared/math/line2d.h"
+#include "map_cache.h"
+#include "visibility_cache.h"
+#include "vector_map.h"
+
+using Eigen::Vector2f;
+using geometry::Line2f;
+using std::max;
+using std::min;
+using std::string;
+using std::vector;
+
+namespace {
+// Identifies the cache file format, and its version.
+const uint32_t kCacheMagic = 0x53565056;  // "VPVS"
+const uint32_t kCacheVersion = 1;
+
+struct CacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t lines_hash;
+  uint64_t num_lines;
+  float cell_size;
+  float max_range;
+  float origin_x;
+  float origin_y;
+  int32_t width;
+  int32_t height;
+  uint64_t num_indices;
+};
+}  // namespace
+
+namespace vector_map {
+
+VisibilityCache::VisibilityCache() :
+    lines_hash_(0),
+    num_lines_(0),
+    cell_size_(1),
+    max_range_(0),
+    origin_(0, 0),
+    width_(0),
+    height_(0) {}
+
+void VisibilityCache::Clear() {
+  lines_hash_ = 0;
+  num_lines_ = 0;
+  max_range_ = 0;
+  width_ = 0;
+  height_ = 0;
+  cell_start_.clear();
+  cell_lines_.clear();
+}
+
+string VisibilityCache::CacheFileName(const string& map_file) {
+  return MapSideFileName(map_file, ".visibility.bin");
+}
+
+uint64_t VisibilityCache::HashLines(const vector<Line2f>& lines) {
+  uint64_t hash = kHashSeed;
+  for (const Line2f& l : lines) {
+    const float v[4] = {l.p0.x(), l.p0.y(), l.p1.x(), l.p1.y()};
+    hash = HashBytes(v, sizeof(v), hash);
+  }
+  return hash;
+}
+
+void VisibilityCache::Build(const vector<Line2f>& lines,
+                            const LineGrid& grid,
+                            float cell_size,
+                            float max_range) {
+  // Number of visibility samples along each cell edge.
+  static const int kSamplesPerEdge = 16;
+  Clear();
+  if (lines.empty() || cell_size <= 0.0) return;
+  Vector2f bmin = lines[0].p0;
+  Vector2f bmax = lines[0].p0;
+  for (const Line2f& l : lines) {
+    bmin = bmin.cwiseMin(l.p0).cwiseMin(l.p1);
+    bmax = bmax.cwiseMax(l.p0).cwiseMax(l.p1);
+  }
+  lines_hash_ = HashLines(lines);
+  num_lines_ = lines.size();
+  cell_size_ = cell_size;
+  max_range_ = max_range;
+  origin_ = bmin;
+  width_ = static_cast<int>(floor((bmax.x() - bmin.x()) / cell_size_)) + 1;
+  height_ = static_cast<int>(floor((bmax.y() - bmin.y()) / cell_size_)) + 1;
+
+  // Each sample lies on the boundary of the cells in the range
+  // [cx0, cx1] x [cy0, cy1].
+  struct Sample {
+    Vector2f loc;
+    int cx0;
+    int cx1;
+    int cy0;
+    int cy1;
+  };
+  const int n = kSamplesPerEdge;
+  const float spacing = cell_size_ / n;
+  vector<Sample> samples;
+  for (int j = 0; j <= height_; ++j) {
+    for (int i = 0; i <= width_ * n; ++i) {
+      Sample s;
+      s.loc = origin_ + Vector2f(i * spacing, j * cell_size_);
+      s.cx0 = (i % n == 0) ? i / n - 1 : i / n;
+      s.cx1 = i / n;
+      s.cy0 = j - 1;
+      s.cy1 = j;
+      samples.push_back(s);
+    }
+  }
+  for (int i = 0; i <= width_; ++i) {
+    for (int j = 0; j <= height_ * n; ++j) {
+      // Grid corners were already sampled along the horizontal edges.
+      if (j % n == 0) continue;
+      Sample s;
+      s.loc = origin_ + Vector2f(i * cell_size_, j * spacing);
+      s.cx0 = i - 1;
+      s.cx1 = i;
+      s.cy0 = j / n;
+      s.cy1 = j / n;
+      samples.push_back(s);
+    }
+  }
+
+  const float range = max_range_ + spacing;
+  vector<vector<int> > sample_lines(samples.size());
+#ifdef _OPENMP
+  #pragma omp parallel
+#endif
+  {
+    // Scratch buffers for each thread.
+    ScanWorkspace workspace;
+    vector<int>& candidates = workspace.candidates;
+    vector<Line2f>& scene = workspace.scene_lines;
+    vector<int> ids;
+#ifdef _OPENMP
+    #pragma omp for schedule(dynamic, 16)
+#endif
+    for (size_t k = 0; k < samples.size(); ++k) {
+      const Vector2f& loc = samples[k].loc;
+      candidates.clear();
+      grid.QueryBox(loc - Vector2f(range, range),
+                    loc + Vector2f(range, range),
+                    &candidates);
+      scene.resize(candidates.size());
+      for (size_t i = 0; i < candidates.size(); ++i) {
+        scene[i] = lines[candidates[i]];
+      }
+      VisibleSegments(
+          loc, scene, &workspace.sweep, &workspace.visible, &ids);
+      for (const int id : ids) {
+        sample_lines[k].push_back(candidates[id]);
+      }
+    }
+  }
+
+  vector<vector<int> > cells(width_ * height_);
+  for (size_t k = 0; k < samples.size(); ++k) {
+    const Sample& s = samples[k];
+    for (int y = max(0, s.cy0); y <= min(height_ - 1, s.cy1); ++y) {
+      for (int x = max(0, s.cx0); x <= min(width_ - 1, s.cx1); ++x) {
+        const vector<int>& visible = sample_lines[k];
+        vector<int>& cell = cells[y * width_ + x];
+        cell.insert(cell.end(), visible.begin(), visible.end());
+      }
+    }
+  }
+  cell_start_.resize(cells.size() + 1);
+  cell_start_[0] = 0;
+  for (int y = 0; y < height_; ++y) {
+    for (int x = 0; x < width_; ++x) {
+      vector<int>& cell = cells[y * width_ + x];
+      // Lines inside the cell may be seen without looking across its
+      // boundary.
+      const Vector2f cell_min = origin_ + cell_size_ * Vector2f(x, y);
+      grid.QueryBox(cell_min,
+                    cell_min + Vector2f(cell_size_, cell_size_),
+                    &cell);
+      std::sort(cell.begin(), cell.end());
+      cell.erase(std::unique(cell.begin(), cell.end()), cell.end());
+      cell_lines_.insert(cell_lines_.end(), cell.begin(), cell.end());
+      cell_start_[y * width_ + x + 1] = cell_lines_.size();
+      vector<int>().swap(cell);
+    }
+  }
+}
+
+bool VisibilityCache::Lookup(const Vector2f& loc,
+                             const int** indices,
+                             int* num_indices) const {
+  if (width_ == 0 || height_ == 0) return false;
+  const int x = static_cast<int>(floor((loc.x() - origin_.x()) / cell_size_));
+  const int y = static_cast<int>(floor((loc.y() - origin_.y()) / cell_size_));
+  if (x < 0 || y < 0 || x >= width_ || y >= height_) return false;
+  const int c = y * width_ + x;
+  *indices = cell_lines_.data() + cell_start_[c];
+  *num_indices = cell_start_[c + 1] - cell_start_[c];
+  return true;
+}
+
+bool VisibilityCache::Save(const string& file) const {
+  FILE* fid = fopen(file.c_str(), "wb");
+  if (fid == NULL) return false;
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kCacheMagic;
+  header.version = kCacheVersion;
+  header.lines_hash = lines_hash_;
+  header.num_lines = num_lines_;
+  header.cell_size = cell_size_;
+  header.max_range = max_range_;
+  header.origin_x = origin_.x();
+  header.origin_y = origin_.y();
+  header.width = width_;
+  header.height = height_;
+  header.num_indices = cell_lines_.size();
+  bool ok = (fwrite(&header, sizeof(header), 1, fid) == 1);
+  ok = ok && (fwrite(cell_start_.data(), sizeof(int), cell_start_.size(), fid)
+              == cell_start_.size());
+  ok = ok && (fwrite(cell_lines_.data(), sizeof(int), cell_lines_.size(), fid)
+              == cell_lines_.size());
+  fclose(fid);
+  return ok;
+}
+
+bool VisibilityCache::Load(const string& file,
+                           const vector<Line2f>& lines,
+                           float cell_size,
+                           float max_range) {
+  Clear();
+  FILE* fid = fopen(file.c_str(), "rb");
+  if (fid == NULL) return false;
+  CacheHeader header;
+  if (fread(&header, sizeof(header), 1, fid) != 1 ||
+      header.magic != kCacheMagic ||
+      header.version != kCacheVersion ||
+      header.num_lines != lines.size() ||
+      header.cell_size != cell_size ||
+      header.max_range != max_range ||
+      header.width <= 0 ||
+      header.height <= 0 ||
+      header.lines_hash != HashLines(lines)) {
+    fclose(fid);
+    return false;
+  }
+  cell_start_.resize(static_cast<size_t>(header.width) * header.height + 1);
+  cell_lines_.resize(header.num_indices);
+  const bool ok =
+      fread(cell_start_.data(), sizeof(int), cell_start_.size(), fid) ==
+          cell_start_.size() &&
+      fread(cell_lines_.data(), sizeof(int), cell_lines_.size(), fid) ==
+          cell_lines_.size();
+  fclose(fid);
+  if (!ok || cell_start_.back() != static_cast<int>(cell_lines_.size())) {
+    Clear();
+    return false;
+  }
+  lines_hash_ = header.lines_hash;
+  num_lines_ = header.num_lines;
+  cell_size_ = header.cell_size;
+  max_range_ = header.max_range;
+  origin_ = Vector2f(header.origin_x, header.origin_y);
+  width_ = header.width;
+  height_ = header.height;
+  return true;
+}
+
+}  // namespace vector_map
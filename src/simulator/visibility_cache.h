@@ -0,0 +1,101 @@
+//========================================================================
+//  This software is free: you can redistribute it and/or modify
+//  it under the terms of the GNU Lesser General Public License Version 3,
+//  as published by the Free Software Foundation.
+//
+//  This software is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU Lesser General Public License for more details.
+//
+//  You should have received a copy of the GNU Lesser General Public License
+//  Version 3 in the file COPYING that came with this distribution.
+//  If not, see <http://www.gnu.org/licenses/>.
+//========================================================================
+/*!
+\file    visibility_cache.h
+\brief   Precomputed potentially visible sets of static map lines.
+*/
+//========================================================================
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "eigen3/Eigen/Dense"
+#include "math/line2d.h"
+
+#include "line_grid.h"
+
+#ifndef SRC_SIMULATOR_VISIBILITY_CACHE_H_
+#define SRC_SIMULATOR_VISIBILITY_CACHE_H_
+
+namespace vector_map {
+
+// For each cell of a coarse grid over the map, the set of static lines that
+// may be visible within a sensor range from anywhere inside the cell (the
+// potentially visible set). Anything visible from inside a cell is also
+// visible from the cell boundary, so the sets are computed by running the
+// visibility sweep from points sampled along the cell boundaries, and adding
+// the lines that overlap the cell itself. Since the boundary is sampled, a
+// line only visible through a gap narrower than the sample spacing may be
+// missed.
+class VisibilityCache {
+ public:
+  VisibilityCache();
+
+  // Compute the potentially visible sets for the given lines, with square
+  // cells of side cell_size, for a sensor of range max_range. grid must be
+  // the spatial index over lines.
+  void Build(const std::vector<geometry::Line2f>& lines,
+             const LineGrid& grid,
+             float cell_size,
+             float max_range);
+
+  void Clear();
+
+  // Save the cache to file. Returns true on success.
+  bool Save(const std::string& file) const;
+
+  // Load the cache from file. Returns false if the file does not exist, or
+  // was computed for different lines or parameters.
+  bool Load(const std::string& file,
+            const std::vector<geometry::Line2f>& lines,
+            float cell_size,
+            float max_range);
+
+  // Number of lines the cache was computed for.
+  size_t NumLines() const { return num_lines_; }
+
+  float MaxRange() const { return max_range_; }
+
+  // Get the potentially visible lines from loc. Returns false if loc is
+  // outside the cached region.
+  bool Lookup(const Eigen::Vector2f& loc,
+              const int** indices,
+              int* num_indices) const;
+
+  // Name of the cache file used for a map file.
+  static std::string CacheFileName(const std::string& map_file);
+
+  // Hash of the lines, to validate a saved cache against.
+  static uint64_t HashLines(const std::vector<geometry::Line2f>& lines);
+
+ private:
+  uint64_t lines_hash_;
+  size_t num_lines_;
+  float cell_size_;
+  float max_range_;
+  Eigen::Vector2f origin_;
+  int width_;
+  int height_;
+  // The lines visible from cell c are cell_lines_[i] for
+  // cell_start_[c] <= i < cell_start_[c + 1], in increasing order.
+  std::vector<int> cell_start_;
+  std::vector<int> cell_lines_;
+};
+
+}  // namespace vector_map
+
+#endif  // SRC_SIMULATOR_VISIBILITY_CACHE_H_